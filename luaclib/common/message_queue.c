@@ -1,132 +1,154 @@
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
 #include "message_queue.h"
 
 #define THRESHOLD 1024
 
-struct queue_context {
-	int head;
-	int tail;
-	int cap;
-	struct queue_message* message;
-	int threshold;
-	int overload;
+//多生产者单消费者的无锁链表队列(Vyukov),生产者只做一次原子交换,消费者独占head
+struct queue_node {
+	struct queue_node* next;
+	struct queue_message message;
 };
 
 struct message_queue {
-	struct queue_context queue[2];
-	pthread_mutex_t lock;
-	int reader;
-	int writer;
+	struct queue_node* head;
+	char pad0[64 - sizeof(struct queue_node*)];
+	struct queue_node* tail;
+	int size;
+	char pad1[64 - sizeof(struct queue_node*) - sizeof(int)];
+	struct queue_node stub;
+	struct queue_message current;
+	int threshold;
+	int doorbell;
 };
 
 struct message_queue* 
 queue_create() {
-	struct message_queue* mq_ctx = malloc(sizeof(*mq_ctx));
-	int i;
-	for(i = 0;i < 2;i++) {
-		struct queue_context* q = &mq_ctx->queue[i];
-		q->tail = q->head = 0;
-		q->cap = 8;
-		q->threshold = THRESHOLD;
-		q->overload = 0;
-		q->message = malloc(sizeof(*q->message) * q->cap);
-		memset(q->message,0,sizeof(*q->message) * q->cap);
+	struct message_queue* mq = malloc(sizeof(*mq));
+	memset(mq,0,sizeof(*mq));
+	mq->head = mq->tail = &mq->stub;
+	mq->threshold = THRESHOLD;
+	mq->doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (mq->doorbell < 0) {
+		fprintf(stderr,"queue create eventfd error:%s\n",strerror(errno));
+		exit(1);
 	}
-	mq_ctx->reader = 0;
-	mq_ctx->writer = 1;
-	pthread_mutex_init(&mq_ctx->lock, NULL);
-	return mq_ctx;
+	return mq;
 }
 
 void
 queue_free(struct message_queue* mq) {
-	free(mq->queue[0].message);
-	free(mq->queue[1].message);
-	pthread_mutex_destroy(&mq->lock);
+	struct queue_node* node = mq->head;
+	while(node) {
+		struct queue_node* next = node->next;
+		if (node != &mq->stub) {
+			free(node);
+		}
+		node = next;
+	}
+	close(mq->doorbell);
 	free(mq);
 }
 
-static inline int
-queue_length(struct queue_context *q) {
-	int head, tail,cap;
-	head = q->head;
-	tail = q->tail;
-	cap = q->cap;
-
-	if (head <= tail) {
-		return tail - head;
-	}
-	return tail + cap - head;
+static inline void
+queue_link(struct message_queue* mq,struct queue_node* node) {
+	node->next = NULL;
+	struct queue_node* prev = __atomic_exchange_n(&mq->tail, node, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
 }
 
+//只有队列从空变成非空的那个生产者需要敲门
 void
 queue_push(struct message_queue* mq,int source,int session,void* data,size_t size) {
-	pthread_mutex_lock(&mq->lock);
-	assert(mq->writer != mq->reader);
-	struct queue_context* q = &mq->queue[mq->writer];
-
-	struct queue_message* message = &q->message[q->tail];
-	message->source = source;
-	message->session = session;
-	message->data = data;
-	message->size = size;
-
-	if (++q->tail >= q->cap)
-		q->tail = 0;
-	
-	if (q->head == q->tail) {
-		struct queue_message* nmesasge = malloc(sizeof(*nmesasge) * q->cap * 2);
-		int i;
-		for(i = 0;i < q->cap;i++) {
-			nmesasge[i] = q->message[(q->head + i)%q->cap];
+	struct queue_node* node = malloc(sizeof(*node));
+	node->message.source = source;
+	node->message.session = session;
+	node->message.data = data;
+	node->message.size = size;
+
+	//先加计数再挂节点,消费者看到计数大于0但还拿不到节点时会稍等,不会提前睡下
+	int length = __atomic_fetch_add(&mq->size, 1, __ATOMIC_ACQ_REL);
+	queue_link(mq, node);
+
+	if (length == 0) {
+		uint64_t one = 1;
+		if (write(mq->doorbell, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+			fprintf(stderr,"queue doorbell write error:%s\n",strerror(errno));
 		}
-		q->head = 0;
-		q->tail = q->cap;
-		q->cap *= 2;
-		free(q->message);
-		q->message = nmesasge;
 	}
-
-	if (queue_length(q) >= q->threshold) {
-		q->threshold = q->threshold * 2;
-		q->overload = 1;
-	}
-	pthread_mutex_unlock(&mq->lock);
 }
 
+//返回的消息在下一次pop之前有效
 struct queue_message*
 queue_pop(struct message_queue* mq,int ud) {
-	struct queue_context* queue = &mq->queue[mq->reader];
-	
-	if (queue->overload == 1) {
-		queue->overload = 0;
-		fprintf(stderr,"ctx:[%d] reader queue overload:%d\n",ud,queue_length(queue));
-	}
-
-	if (queue->head != queue->tail) {
-		struct queue_message* message = &queue->message[queue->head++];
-		if (queue->head >= queue->cap) {
-			queue->head = 0;
+	for(;;) {
+		int size = __atomic_load_n(&mq->size, __ATOMIC_ACQUIRE);
+		if (size == 0) {
+			return NULL;
+		}
+		if (size >= mq->threshold) {
+			fprintf(stderr,"ctx:[%d] reader queue overload:%d\n",ud,size);
+			while(size >= mq->threshold) {
+				mq->threshold *= 2;
+			}
 		}
-		return message;
-	}
-
-	pthread_mutex_lock(&mq->lock);
 
-	++mq->writer;
-	++mq->reader;
-	mq->writer = mq->writer % 2;
-	mq->reader = mq->reader % 2;
+		struct queue_node* head = mq->head;
+		struct queue_node* next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+		if (head == &mq->stub) {
+			if (next == NULL) {
+				//计数已经加上,但生产者还没把节点挂上来
+				sched_yield();
+				continue;
+			}
+			mq->head = next;
+			head = next;
+			next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+		}
 
-	pthread_mutex_unlock(&mq->lock);
+		if (next == NULL) {
+			//head是最后一个节点,把stub挂到尾部才能把head摘下来
+			if (head != __atomic_load_n(&mq->tail, __ATOMIC_ACQUIRE)) {
+				sched_yield();
+				continue;
+			}
+			queue_link(mq, &mq->stub);
+			next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+			if (next == NULL) {
+				sched_yield();
+				continue;
+			}
+		}
 
-	queue = &mq->queue[mq->reader];
+		mq->head = next;
+		mq->current = head->message;
+		free(head);
+		__atomic_fetch_sub(&mq->size, 1, __ATOMIC_ACQ_REL);
+		return &mq->current;
+	}
+}
 
-	if (queue->head != queue->tail) {
-		struct queue_message* message = &queue->message[queue->head++];
-		if (queue->head >= queue->cap) {
-			queue->head = 0;
-		}
-		return message;
+//队列为空时等门铃,millis小于0一直等,返回0表示被唤醒
+int
+queue_wait(struct message_queue* mq,int millis) {
+	if (__atomic_load_n(&mq->size, __ATOMIC_ACQUIRE) > 0) {
+		return 0;
 	}
-	return NULL;
-}
\ No newline at end of file
+	struct pollfd pfd;
+	pfd.fd = mq->doorbell;
+	pfd.events = POLLIN;
+	int ret = poll(&pfd, 1, millis);
+	if (ret <= 0) {
+		return -1;
+	}
+	uint64_t count;
+	if (read(mq->doorbell, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		fprintf(stderr,"queue doorbell read error:%s\n",strerror(errno));
+	}
+	return 0;
+}
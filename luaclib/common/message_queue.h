@@ -21,7 +21,8 @@ struct message_queue;
 struct message_queue* queue_create();
 void queue_free(struct message_queue* queue_ctx);
 
-inline void queue_push(struct message_queue* queue_ctx,int source,int session,void* data,size_t size);
-inline struct queue_message* queue_pop(struct message_queue* queue_ctx,int ud);
+void queue_push(struct message_queue* queue_ctx,int source,int session,void* data,size_t size);
+struct queue_message* queue_pop(struct message_queue* queue_ctx,int ud);
+int queue_wait(struct message_queue* queue_ctx,int millis);
 
-#endif
\ No newline at end of file
+#endif
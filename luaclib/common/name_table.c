@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "name_table.h"
+
+#define NAME_TABLE_SIZE 64
+#define NAME_TABLE_MAX 65536
+
+typedef struct name_node {
+	char* name;
+	size_t size;
+} name_node_t;
+
+//名字只增不删,只能放文件名和方法名这种固定的名字,超过NAME_TABLE_MAX个返回-1
+//查找只在各个lua状态的缓存没命中时发生,一把锁就够了
+static pthread_mutex_t _NAME_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+static name_node_t* _NAME_SLOT = NULL;
+static int _NAME_COUNT = 0;
+static int _NAME_CAP = 0;
+
+int
+name_table_id(const char* name, size_t size) {
+	pthread_mutex_lock(&_NAME_MUTEX);
+	int i;
+	for (i = 0; i < _NAME_COUNT; i++) {
+		name_node_t* node = &_NAME_SLOT[i];
+		if (node->size == size && memcmp(node->name, name, size) == 0) {
+			pthread_mutex_unlock(&_NAME_MUTEX);
+			return i;
+		}
+	}
+
+	if (_NAME_COUNT >= NAME_TABLE_MAX) {
+		pthread_mutex_unlock(&_NAME_MUTEX);
+		return -1;
+	}
+
+	if (_NAME_COUNT == _NAME_CAP) {
+		int ncap = _NAME_CAP == 0 ? NAME_TABLE_SIZE : _NAME_CAP * 2;
+		_NAME_SLOT = realloc(_NAME_SLOT, sizeof(name_node_t) * ncap);
+		_NAME_CAP = ncap;
+	}
+
+	name_node_t* node = &_NAME_SLOT[_NAME_COUNT];
+	node->name = malloc(size + 1);
+	memcpy(node->name, name, size);
+	node->name[size] = '\0';
+	node->size = size;
+
+	int id = _NAME_COUNT++;
+	pthread_mutex_unlock(&_NAME_MUTEX);
+	return id;
+}
+
+const char*
+name_table_name(int id, size_t* size) {
+	const char* name = NULL;
+	pthread_mutex_lock(&_NAME_MUTEX);
+	if (id >= 0 && id < _NAME_COUNT) {
+		name = _NAME_SLOT[id].name;
+		*size = _NAME_SLOT[id].size;
+	}
+	pthread_mutex_unlock(&_NAME_MUTEX);
+	return name;
+}
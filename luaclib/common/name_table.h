@@ -0,0 +1,10 @@
+#ifndef NAME_TABLE_H
+#define NAME_TABLE_H
+
+#include <stddef.h>
+
+//进程内共享的名字表,线程间通信时用id代替文件名和方法名,只编进name.so一份
+int name_table_id(const char* name, size_t size);
+const char* name_table_name(int id, size_t* size);
+
+#endif
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+#include "spsc_queue.h"
+
+#define CACHE_LINE 64
+
+//head只由消费者写,tail只由生产者写,分开放在不同的cache line上
+struct spsc_queue {
+	uint32_t head;
+	char pad0[CACHE_LINE - sizeof(uint32_t)];
+	uint32_t tail;
+	char pad1[CACHE_LINE - sizeof(uint32_t)];
+	uint32_t mask;
+	void** slot;
+};
+
+struct spsc_queue*
+spsc_queue_create(uint32_t size) {
+	uint32_t cap = 2;
+	while(cap < size) {
+		cap <<= 1;
+	}
+	struct spsc_queue* queue = malloc(sizeof(*queue));
+	memset(queue,0,sizeof(*queue));
+	queue->mask = cap - 1;
+	queue->slot = malloc(sizeof(void*) * cap);
+	return queue;
+}
+
+void
+spsc_queue_release(struct spsc_queue* queue) {
+	free(queue->slot);
+	free(queue);
+}
+
+//队列满时返回-1,由调用者决定怎么处理
+int
+spsc_queue_push(struct spsc_queue* queue,void* data) {
+	uint32_t tail = queue->tail;
+	uint32_t head = __atomic_load_n(&queue->head,__ATOMIC_ACQUIRE);
+	if (tail - head > queue->mask) {
+		return -1;
+	}
+	queue->slot[tail & queue->mask] = data;
+	__atomic_store_n(&queue->tail,tail + 1,__ATOMIC_RELEASE);
+	return 0;
+}
+
+void*
+spsc_queue_pop(struct spsc_queue* queue) {
+	uint32_t head = queue->head;
+	uint32_t tail = __atomic_load_n(&queue->tail,__ATOMIC_ACQUIRE);
+	if (head == tail) {
+		return NULL;
+	}
+	void* data = queue->slot[head & queue->mask];
+	__atomic_store_n(&queue->head,head + 1,__ATOMIC_RELEASE);
+	return data;
+}
@@ -0,0 +1,14 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdint.h>
+
+//单生产者单消费者的无锁环形队列,只存指针
+struct spsc_queue;
+
+struct spsc_queue* spsc_queue_create(uint32_t size);
+void spsc_queue_release(struct spsc_queue* queue);
+int spsc_queue_push(struct spsc_queue* queue,void* data);
+void* spsc_queue_pop(struct spsc_queue* queue);
+
+#endif
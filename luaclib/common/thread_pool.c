@@ -2,11 +2,15 @@
 #include "lock.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 
+#define CACHE_LINE 64
+#define DEQUE_SIZE 256
+#define WAIT_TIME 10
 
 typedef struct task {
 	struct task* next;
@@ -16,21 +20,50 @@ typedef struct task {
 	size_t size;
 } task_t;
 
-typedef struct task_queue {
-	task_t* head;
-	task_t* tail;
+//扩容后旧的数组可能还在被偷取线程读,挂在prev上等线程池释放时一起回收
+typedef struct deque_array {
+	int64_t size;
+	struct deque_array* prev;
+	task_t* slot[];
+} deque_array_t;
+
+//Chase-Lev双端队列,bottom只由投递线程写,各线程从top用CAS偷
+typedef struct deque {
+	int64_t top;
+	char pad0[CACHE_LINE - sizeof(int64_t)];
+	int64_t bottom;
+	char pad1[CACHE_LINE - sizeof(int64_t)];
+	deque_array_t* array;
+} deque_t;
+
+typedef struct worker_slot {
+	//可以被别的线程偷的任务
+	deque_t shared;
+	//带亲和key的任务,只有本线程取,保证同一个key的任务顺序执行
+	deque_t bind;
+
 	mutex_t mutex;
 	cond_t cond;
-	struct thread_pool* pool;
-} task_queue_t;
+	int sleeping;
 
+	int index;
+	struct thread_pool* pool;
+} worker_slot_t;
 
 typedef struct thread_pool {
-	task_queue_t* queue;
+	worker_slot_t* slots;
+
+	//投递线程私有的空闲任务节点
+	task_t* freelist;
+	//消费线程归还的任务节点,投递线程取空freelist后整条摘走
+	task_t* recycle;
 
 	int closed;
 
-	int watting;
+	int next;
+
+	//醒着在找任务的线程数,有线程在找时投递就不用再叫醒别人
+	int searching;
 
 	int thread_count;
 
@@ -43,122 +76,239 @@ typedef struct thread_pool {
 } thread_pool_t;
 
 
-typedef struct consumer_ctx {
-	int index;
-	task_queue_t* queue;
-} consumer_ctx_t;
+static inline deque_array_t*
+deque_array_create(int64_t size) {
+	deque_array_t* array = malloc(sizeof(*array) + size * sizeof(task_t*));
+	array->size = size;
+	array->prev = NULL;
+	return array;
+}
 
+static inline void
+deque_init(deque_t* deque) {
+	deque->top = 0;
+	deque->bottom = 0;
+	deque->array = deque_array_create(DEQUE_SIZE);
+}
 
-task_t*
-create_task(thread_consumer consumer) {
-	task_t* task = malloc(sizeof(*task));
-	task->next = NULL;
-	task->consumer = consumer;
-	return task;
+static inline void
+deque_release(deque_t* deque) {
+	deque_array_t* array = deque->array;
+	while (array) {
+		deque_array_t* prev = array->prev;
+		free(array);
+		array = prev;
+	}
 }
 
-void
-delete_task(task_t* task) {
-	free(task);
+static deque_array_t*
+deque_grow(deque_t* deque, deque_array_t* array, int64_t top, int64_t bottom) {
+	deque_array_t* narray = deque_array_create(array->size * 2);
+	int64_t i;
+	for (i = top; i < bottom; i++) {
+		narray->slot[i & (narray->size - 1)] = __atomic_load_n(&array->slot[i & (array->size - 1)], __ATOMIC_RELAXED);
+	}
+	narray->prev = array;
+	__atomic_store_n(&deque->array, narray, __ATOMIC_RELEASE);
+	return narray;
+}
+
+static inline void
+deque_push(deque_t* deque, task_t* task) {
+	int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	deque_array_t* array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+	if (bottom - top > array->size - 1) {
+		array = deque_grow(deque, array, top, bottom);
+	}
+	__atomic_store_n(&array->slot[bottom & (array->size - 1)], task, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
 }
 
-static inline task_queue_t*
-create_queue() {
-	task_queue_t* queue = malloc(sizeof(*queue));
-	queue->head = NULL;
-	queue->tail = NULL;
+static inline task_t*
+deque_steal(deque_t* deque) {
+	for (;;) {
+		int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+		if (top >= bottom) {
+			return NULL;
+		}
+		deque_array_t* array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+		task_t* task = __atomic_load_n(&array->slot[top & (array->size - 1)], __ATOMIC_RELAXED);
+		if (__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			return task;
+		}
+	}
+}
 
-	mutex_init(&queue->mutex);
-	cond_init(&queue->cond);
+static inline int
+deque_empty(deque_t* deque) {
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+	int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST);
+	return top >= bottom;
+}
 
-	return queue;
+static inline task_t*
+create_task(thread_pool_t* pool, thread_consumer consumer) {
+	task_t* task = pool->freelist;
+	if (!task) {
+		task = __atomic_exchange_n(&pool->recycle, NULL, __ATOMIC_ACQUIRE);
+	}
+	if (task) {
+		pool->freelist = task->next;
+	} else {
+		task = malloc(sizeof(*task));
+	}
+	task->next = NULL;
+	task->consumer = consumer;
+	return task;
 }
 
 static inline void
-delete_queue(task_queue_t* queue) {
-	assert(queue->head = NULL);
-	assert(queue->tail = NULL);
+delete_task(thread_pool_t* pool, task_t* task) {
+	task_t* head = __atomic_load_n(&pool->recycle, __ATOMIC_RELAXED);
+	do {
+		task->next = head;
+	} while (!__atomic_compare_exchange_n(&pool->recycle, &head, task, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
-	mutex_destroy(&queue->mutex);
-	cond_destroy(&queue->cond);
+static inline void
+free_task_list(task_t* task) {
+	while (task) {
+		task_t* next = task->next;
+		free(task);
+		task = next;
+	}
+}
 
-	free(queue);
-} 
+//先取自己的亲和任务和共享任务,没有再从下一个线程开始轮流偷
+static inline task_t*
+take_task(thread_pool_t* pool, worker_slot_t* slot) {
+	task_t* task = deque_steal(&slot->bind);
+	if (task) {
+		return task;
+	}
+	task = deque_steal(&slot->shared);
+	if (task) {
+		return task;
+	}
+	int i;
+	for (i = 1; i < pool->thread_count; i++) {
+		worker_slot_t* victim = &pool->slots[(slot->index + i) % pool->thread_count];
+		task = deque_steal(&victim->shared);
+		if (task) {
+			return task;
+		}
+	}
+	return NULL;
+}
 
 static inline int
-queue_empty(task_queue_t* queue) {
-	return queue->head == NULL;
+has_task(thread_pool_t* pool, worker_slot_t* slot) {
+	if (!deque_empty(&slot->bind)) {
+		return 1;
+	}
+	int i;
+	for (i = 0; i < pool->thread_count; i++) {
+		if (!deque_empty(&pool->slots[i].shared)) {
+			return 1;
+		}
+	}
+	return 0;
 }
 
-void
-task_push(task_queue_t* queue, task_t* task) {
-	if (queue->pool->closed == 1) {
-		return;
+//由叫醒的一方清掉sleeping并替它计入searching,线程真正醒来之前后续投递不会重复发信号
+static inline int
+slot_wakeup(thread_pool_t* pool, worker_slot_t* slot) {
+	if (!__atomic_load_n(&slot->sleeping, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	if (!__atomic_exchange_n(&slot->sleeping, 0, __ATOMIC_ACQ_REL)) {
+		return 0;
 	}
+	__atomic_add_fetch(&pool->searching, 1, __ATOMIC_SEQ_CST);
+	mutex_lock(&slot->mutex);
+	cond_notify_one(&slot->cond);
+	mutex_unlock(&slot->mutex);
+	return 1;
+}
 
-	if (queue->head == NULL) {
-		assert(queue->tail == NULL);
-		task->next = NULL;
-		queue->head = queue->tail = task;
-	} else {
-		task->next = NULL;
-		queue->tail->next = task;
-		queue->tail = task;
+static inline void
+wakeup_one(thread_pool_t* pool, worker_slot_t* prefer) {
+	if (slot_wakeup(pool, prefer)) {
+		return;
+	}
+	int i;
+	for (i = 0; i < pool->thread_count; i++) {
+		if (slot_wakeup(pool, &pool->slots[i])) {
+			return;
+		}
 	}
 }
 
-task_t*
-task_pop(task_queue_t* queue) {
-	task_t* task = queue->head;
-	if (queue->head == queue->tail) {
-		queue->head = queue->tail = NULL;
-	} else {
-		queue->head = task->next;
+//先标记sleeping再检查队列,投递线程先入队再看sleeping,两边至少有一边能看到对方
+static inline void
+slot_park(thread_pool_t* pool, worker_slot_t* slot) {
+	mutex_lock(&slot->mutex);
+	__atomic_store_n(&slot->sleeping, 1, __ATOMIC_SEQ_CST);
+	if (!has_task(pool, slot) && !__atomic_load_n(&pool->closed, __ATOMIC_ACQUIRE)) {
+		cond_timed_wait(&slot->cond, &slot->mutex, WAIT_TIME);
 	}
-	return task;
+	//超时或者自己发现了任务醒来,没人替它计数
+	if (__atomic_exchange_n(&slot->sleeping, 0, __ATOMIC_ACQ_REL)) {
+		__atomic_add_fetch(&pool->searching, 1, __ATOMIC_SEQ_CST);
+	}
+	mutex_unlock(&slot->mutex);
 }
 
 void*
 thread_pool_consumer(void* ud) {
-	consumer_ctx_t* ctx = ud;
+	worker_slot_t* slot = ud;
+	thread_pool_t* pool = slot->pool;
 
-	task_queue_t* queue = ctx->queue;
-	if (queue->pool->init_func) {
-		queue->pool->init_func(queue->pool, ctx->index, queue->pool->ud);
+	if (pool->init_func) {
+		pool->init_func(pool, slot->index, pool->ud);
 	}
 
+	int searching = 1;
+	__atomic_add_fetch(&pool->searching, 1, __ATOMIC_SEQ_CST);
+
 	for(;;) {
-		mutex_lock(&queue->mutex);
-		task_t* task = task_pop(queue);
-		if (!task) {
-			if (queue->pool->closed == 1) {
-				mutex_unlock(&queue->mutex);
-				break;
-			} else {
-				++queue->pool->watting;
+		task_t* task = take_task(pool, slot);
+		if (task) {
+			//最后一个找任务的线程找到了活,队列里还有就再叫醒一个
+			if (searching) {
+				searching = 0;
+				if (__atomic_sub_fetch(&pool->searching, 1, __ATOMIC_SEQ_CST) == 0 && has_task(pool, slot)) {
+					wakeup_one(pool, slot);
+				}
+			}
+			task->consumer(pool, slot->index, task->session, task->data, task->size, pool->ud);
+			delete_task(pool, task);
+			continue;
+		}
 
-				cond_timed_wait(&queue->cond, &queue->mutex, 10);
+		if (searching) {
+			searching = 0;
+			__atomic_sub_fetch(&pool->searching, 1, __ATOMIC_SEQ_CST);
+		}
 
-				--queue->pool->watting;
+		if (__atomic_load_n(&pool->closed, __ATOMIC_ACQUIRE)) {
+			break;
+		}
 
-				mutex_unlock(&queue->mutex);
+		slot_park(pool, slot);
+		searching = 1;
 
-				if (queue->pool->wakeup_func) {
-					queue->pool->wakeup_func(queue->pool, ctx->index, queue->pool->ud);
-				}
-			}
-			
-		} else {
-			mutex_unlock(&queue->mutex);
-			task->consumer(queue->pool, ctx->index, task->session, task->data, task->size, queue->pool->ud);
-			delete_task(task);
+		if (pool->wakeup_func) {
+			pool->wakeup_func(pool, slot->index, pool->ud);
 		}
 	}
-	if (queue->pool->fina_func) {
-		queue->pool->fina_func(queue->pool, ctx->index, queue->pool->ud);
+	if (pool->fina_func) {
+		pool->fina_func(pool, slot->index, pool->ud);
 	}
 
-	free(ctx);
 	return NULL;
 }
 
@@ -168,22 +318,34 @@ thread_pool_create(thread_init init_func, thread_fina fina_func, thread_wakeup w
 	thread_pool_t* pool = malloc(sizeof(*pool));
 	memset(pool, 0, sizeof(*pool));
 
-	pool->queue = create_queue();
 	pool->closed = 0;
-	pool->watting = 0;
+	pool->next = 0;
 
 	pool->init_func = init_func;
 	pool->fina_func = fina_func;
 	pool->wakeup_func = wakeup_func;
 	pool->ud = ud;
 
-	pool->queue->pool = pool;
 	return pool;
 }
 
-void 
+void
 thread_pool_release(struct thread_pool* pool) {
-	delete_queue(pool->queue);
+	int i;
+	for (i = 0; i < pool->thread_count; i++) {
+		worker_slot_t* slot = &pool->slots[i];
+		assert(deque_empty(&slot->shared));
+		assert(deque_empty(&slot->bind));
+		deque_release(&slot->shared);
+		deque_release(&slot->bind);
+		mutex_destroy(&slot->mutex);
+		cond_destroy(&slot->cond);
+	}
+	free(pool->slots);
+	free(pool->pids);
+
+	free_task_list(pool->freelist);
+	free_task_list(pool->recycle);
 	free(pool);
 }
 
@@ -191,14 +353,24 @@ void
 thread_pool_start(thread_pool_t* pool, int thread_count) {
 	pool->thread_count = thread_count;
 	pool->pids = malloc(thread_count * sizeof(pthread_t));
+	pool->slots = malloc(thread_count * sizeof(worker_slot_t));
+	memset(pool->slots, 0, thread_count * sizeof(worker_slot_t));
 
 	int i;
+	for(i = 0;i<thread_count;i++) {
+		worker_slot_t* slot = &pool->slots[i];
+		deque_init(&slot->shared);
+		deque_init(&slot->bind);
+		mutex_init(&slot->mutex);
+		cond_init(&slot->cond);
+		slot->sleeping = 0;
+		slot->index = i;
+		slot->pool = pool;
+	}
+
 	for(i = 0;i<thread_count;i++) {
 		pthread_t pid;
-		consumer_ctx_t* ctx = malloc(sizeof(*ctx));
-		ctx->index = i;
-		ctx->queue = pool->queue;
-		pthread_create(&pid, NULL, thread_pool_consumer, ctx);
+		pthread_create(&pid, NULL, thread_pool_consumer, &pool->slots[i]);
 		pool->pids[i] = pid;
 	}
 }
@@ -208,25 +380,61 @@ thread_pool_pid(thread_pool_t* pool, int index) {
 	return pool->pids[index];
 }
 
-void
-thread_pool_push_task(thread_pool_t* pool, thread_consumer consumer, int session, void* data, size_t size) {
-	task_t* task = create_task(consumer);
+static void
+push_task(thread_pool_t* pool, int bind, thread_consumer consumer, int session, void* data, size_t size) {
+	if (__atomic_load_n(&pool->closed, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	task_t* task = create_task(pool, consumer);
 	task->session = session;
 	task->data = data;
 	task->size = size;
 
-	mutex_lock(&pool->queue->mutex);
+	worker_slot_t* slot;
+	if (bind >= 0) {
+		slot = &pool->slots[bind];
+		deque_push(&slot->bind, task);
+	} else {
+		slot = &pool->slots[pool->next];
+		pool->next = (pool->next + 1) % pool->thread_count;
+		deque_push(&slot->shared, task);
+	}
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-	task_push(pool->queue, task);
+	//亲和任务只有目标线程能取,必须叫醒它
+	if (bind >= 0) {
+		slot_wakeup(pool, slot);
+		return;
+	}
 
-	if (pool->watting > 0) {
-		cond_notify_one(&pool->queue->cond);
+	//已经有线程醒着在找任务,它会看到这个任务
+	if (__atomic_load_n(&pool->searching, __ATOMIC_SEQ_CST) > 0) {
+		return;
 	}
+	wakeup_one(pool, slot);
+}
+
+void
+thread_pool_push_task(thread_pool_t* pool, thread_consumer consumer, int session, void* data, size_t size) {
+	push_task(pool, -1, consumer, session, data, size);
+}
 
-	mutex_unlock(&pool->queue->mutex);
+void
+thread_pool_push_affinity(thread_pool_t* pool, uint32_t key, thread_consumer consumer, int session, void* data, size_t size) {
+	push_task(pool, key % pool->thread_count, consumer, session, data, size);
 }
 
 void
 thread_pool_close(struct thread_pool* pool) {
-	pool->closed = 1;
-}
\ No newline at end of file
+	__atomic_store_n(&pool->closed, 1, __ATOMIC_RELEASE);
+
+	int i;
+	for (i = 0; i < pool->thread_count; i++) {
+		worker_slot_t* slot = &pool->slots[i];
+		mutex_lock(&slot->mutex);
+		cond_notify_one(&slot->cond);
+		mutex_unlock(&slot->mutex);
+	}
+}
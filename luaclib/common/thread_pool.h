@@ -2,6 +2,7 @@
 #define THREAD_POOL_H
 
 #include <pthread.h>
+#include <stdint.h>
 
 struct thread_pool;
 
@@ -20,7 +21,10 @@ void thread_pool_close(struct thread_pool* pool);
 
 pthread_t thread_pool_pid(struct thread_pool* pool, int index);
 
+//投递只能在创建线程池的线程里调用
 void thread_pool_push_task(struct thread_pool* pool, thread_consumer consumer, int session, void* data, size_t size);
+//同一个key的任务固定在同一个线程上按顺序执行,不会被偷
+void thread_pool_push_affinity(struct thread_pool* pool, uint32_t key, thread_consumer consumer, int session, void* data, size_t size);
 
 
 #endif
\ No newline at end of file
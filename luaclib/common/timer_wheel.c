@@ -0,0 +1,212 @@
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "timer_wheel.h"
+
+//近端256个槽按tick精确排列,之后4层各64个槽,层层往下搬
+#define TIME_NEAR_SHIFT 8
+#define TIME_NEAR (1 << TIME_NEAR_SHIFT)
+#define TIME_LEVEL_SHIFT 6
+#define TIME_LEVEL (1 << TIME_LEVEL_SHIFT)
+#define TIME_NEAR_MASK (TIME_NEAR - 1)
+#define TIME_LEVEL_MASK (TIME_LEVEL - 1)
+
+struct timer_wheel {
+	struct timer_node near[TIME_NEAR];
+	struct timer_node level[4][TIME_LEVEL];
+	uint32_t time;
+	uint32_t current;
+	int count;
+};
+
+static inline void
+slot_init(struct timer_node* slot) {
+	slot->prev = slot->next = slot;
+}
+
+static inline void
+slot_link(struct timer_node* slot,struct timer_node* node) {
+	node->prev = slot->prev;
+	node->next = slot;
+	slot->prev->next = node;
+	slot->prev = node;
+}
+
+static inline void
+slot_unlink(struct timer_node* node) {
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->prev = node->next = NULL;
+}
+
+//把slot里的节点整串摘到to上,slot置空
+static inline void
+slot_take(struct timer_node* slot,struct timer_node* to) {
+	slot_init(to);
+	if (slot->next == slot) {
+		return;
+	}
+	to->next = slot->next;
+	to->prev = slot->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	slot_init(slot);
+}
+
+static void
+add_node(struct timer_wheel* wheel,struct timer_node* node) {
+	uint32_t time = node->expire;
+	uint32_t current = wheel->time;
+
+	if ((time | TIME_NEAR_MASK) == (current | TIME_NEAR_MASK)) {
+		slot_link(&wheel->near[time & TIME_NEAR_MASK],node);
+	} else {
+		int i;
+		uint32_t mask = TIME_NEAR << TIME_LEVEL_SHIFT;
+		for(i = 0;i < 3;i++) {
+			if ((time | (mask - 1)) == (current | (mask - 1))) {
+				break;
+			}
+			mask <<= TIME_LEVEL_SHIFT;
+		}
+		slot_link(&wheel->level[i][(time >> (TIME_NEAR_SHIFT + i * TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK],node);
+	}
+}
+
+static void
+move_list(struct timer_wheel* wheel,int level,int index) {
+	struct timer_node list;
+	slot_take(&wheel->level[level][index],&list);
+	while(list.next != &list) {
+		struct timer_node* node = list.next;
+		slot_unlink(node);
+		add_node(wheel,node);
+	}
+}
+
+static void
+shift(struct timer_wheel* wheel) {
+	uint32_t ct = ++wheel->time;
+	if (ct == 0) {
+		move_list(wheel,3,0);
+	} else {
+		uint32_t time = ct >> TIME_NEAR_SHIFT;
+		int i = 0;
+		int mask = TIME_NEAR;
+		while((ct & (mask - 1)) == 0) {
+			int index = time & TIME_LEVEL_MASK;
+			if (index != 0) {
+				move_list(wheel,i,index);
+				break;
+			}
+			mask <<= TIME_LEVEL_SHIFT;
+			time >>= TIME_LEVEL_SHIFT;
+			++i;
+		}
+	}
+}
+
+static void
+execute(struct timer_wheel* wheel,timer_expire_func func,void* ud) {
+	struct timer_node list;
+	slot_take(&wheel->near[wheel->time & TIME_NEAR_MASK],&list);
+	while(list.next != &list) {
+		struct timer_node* node = list.next;
+		slot_unlink(node);
+		wheel->count--;
+		func(node,ud);
+	}
+}
+
+struct timer_wheel*
+timer_wheel_create(uint32_t now) {
+	struct timer_wheel* wheel = malloc(sizeof(*wheel));
+	memset(wheel,0,sizeof(*wheel));
+
+	int i,j;
+	for(i = 0;i < TIME_NEAR;i++) {
+		slot_init(&wheel->near[i]);
+	}
+	for(i = 0;i < 4;i++) {
+		for(j = 0;j < TIME_LEVEL;j++) {
+			slot_init(&wheel->level[i][j]);
+		}
+	}
+	wheel->current = now;
+	return wheel;
+}
+
+//节点内存归调用者,这里只负责摘链
+void
+timer_wheel_release(struct timer_wheel* wheel) {
+	int i,j;
+	for(i = 0;i < TIME_NEAR;i++) {
+		while(wheel->near[i].next != &wheel->near[i]) {
+			slot_unlink(wheel->near[i].next);
+		}
+	}
+	for(i = 0;i < 4;i++) {
+		for(j = 0;j < TIME_LEVEL;j++) {
+			while(wheel->level[i][j].next != &wheel->level[i][j]) {
+				slot_unlink(wheel->level[i][j].next);
+			}
+		}
+	}
+	free(wheel);
+}
+
+void
+timer_wheel_add(struct timer_wheel* wheel,struct timer_node* node,uint32_t ticks) {
+	assert(node->next == NULL);
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	node->expire = wheel->time + ticks;
+	add_node(wheel,node);
+	wheel->count++;
+}
+
+void
+timer_wheel_remove(struct timer_wheel* wheel,struct timer_node* node) {
+	if (node->next == NULL) {
+		return;
+	}
+	slot_unlink(node);
+	wheel->count--;
+}
+
+int
+timer_wheel_pending(struct timer_node* node) {
+	return node->next != NULL;
+}
+
+int
+timer_wheel_count(struct timer_wheel* wheel) {
+	return wheel->count;
+}
+
+//now是调用者的tick计数,落后多少tick就推进多少次,每次把到期节点交给func
+void
+timer_wheel_update(struct timer_wheel* wheel,uint32_t now,timer_expire_func func,void* ud) {
+	uint32_t diff = now - wheel->current;
+	wheel->current = now;
+
+	//时间往回走了,只重新对齐current,不能当成差了四十亿个tick去推进
+	if ((int32_t)diff < 0) {
+		return;
+	}
+
+	//没有节点时不需要逐层搬迁,直接跳过去
+	if (wheel->count == 0) {
+		wheel->time += diff;
+		return;
+	}
+
+	uint32_t i;
+	for(i = 0;i < diff;i++) {
+		execute(wheel,func,ud);
+		shift(wheel);
+		execute(wheel,func,ud);
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+struct timer_node {
+	struct timer_node* prev;
+	struct timer_node* next;
+	uint32_t expire;
+};
+
+struct timer_wheel;
+
+typedef void (*timer_expire_func)(struct timer_node* node,void* ud);
+
+struct timer_wheel* timer_wheel_create(uint32_t now);
+void timer_wheel_release(struct timer_wheel* wheel);
+void timer_wheel_add(struct timer_wheel* wheel,struct timer_node* node,uint32_t ticks);
+void timer_wheel_remove(struct timer_wheel* wheel,struct timer_node* node);
+int timer_wheel_pending(struct timer_node* node);
+int timer_wheel_count(struct timer_wheel* wheel);
+void timer_wheel_update(struct timer_wheel* wheel,uint32_t now,timer_expire_func func,void* ud);
+
+#endif
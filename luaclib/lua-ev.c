@@ -14,12 +14,18 @@
 #include "socket/socket_udp.h"
 #include "socket/socket_pipe.h"
 #include "socket/dns_resolver.h"
+#include "socket/reactor.h"
+#include "common/timer_wheel.h"
 
 #define LUA_EV_ERROR    0
 #define LUA_EV_TIMEOUT	1
 #define LUA_EV_ACCEPT   2
 #define LUA_EV_CONNECT  3
 #define LUA_EV_DATA     4
+#define LUA_EV_BATCH    5
+#define LUA_EV_DRAIN    6
+#define LUA_EV_FULL     7
+#define LUA_EV_CALLOUT  8
 
 #define META_EVENT 			"meta_event"
 #define META_SESSION 		"meta_session"
@@ -28,6 +34,8 @@
 #define META_UDP 			"meta_udp"
 #define META_PIPE			"meta_pipe"
 #define META_REQUEST		"meta_request"
+#define META_REACTOR		"meta_reactor"
+#define META_CALLOUT		"meta_callout"
 
 #define STATE_HEAD 0
 #define STATE_BODY 1
@@ -40,15 +48,59 @@
 
 #define MB (1024*1024)
 
+#define BATCH_FLUSH_SIZE (1024 * 1024)
+
+#define WHEEL_TICK 0.01
+
+#define CALLOUT_IDLE 	0
+#define CALLOUT_PENDING 1
+#define CALLOUT_EXPIRED 2
+
+#define SHARD_NONE 	0
+#define SHARD_ROUND 1
+#define SHARD_HASH 	2
+
 __thread char THREAD_CACHED_BUFFER[THREAD_CACHED_SIZE];
 
 struct lev_timer;
+struct ltcp_session;
+struct lcallout;
+
+//data指向session输入缓冲里的原始数据,为空时数据拷在批量缓冲的offset处
+typedef struct lev_packet {
+	char* data;
+	size_t offset;
+	size_t size;
+} lev_packet_t;
+
+typedef struct lev_batch {
+	struct ltcp_session* owner;
+	char* buffer;
+	size_t size;
+	size_t capacity;
+	//已经记下指针但还没drain的输入字节数,包头也算在里面
+	size_t peek;
+	//lua通过packet取到的最大下标,回调里转交时后面的包交给新的reactor
+	int cursor;
+	lev_packet_t* packet;
+	int count;
+	int max;
+} lev_batch_t;
 
 typedef struct lev {
 	struct ev_loop_ctx* loop_ctx;
 	struct dns_resolver* resolver;
 	struct http_multi* multi;
 	struct lev_timer* freelist;
+	lev_batch_t batch;
+
+	struct timer_wheel* wheel;
+	double wheel_base;
+	struct ev_timer ticker;
+	struct lcallout** expired;
+	int expired_count;
+	int expired_max;
+	int expired_ref;
 
 	lua_State* main;
 	int ref;
@@ -68,8 +120,19 @@ typedef struct ltcp_session {
 	int header;
 	int state;
 	int need;
+	int batch;
 		
 	int threhold;
+
+	size_t highwater;
+	size_t lowwater;
+	int full;
+	int pause;
+
+	int handoff;
+	//批量回调里转交时还没处理的包,重新编码成带包头的数据
+	char* rest;
+	size_t rest_size;
 } ltcp_session_t;
 
 typedef struct ludp_session {
@@ -86,8 +149,22 @@ typedef struct ltcp_listener {
 	int ref;
 	int closed;
 	int header;
+	int batch;
+
+	int shard;
+	uint32_t cursor;
+	char group[32];
 } ltcp_listener_t;
 
+typedef struct lreactor {
+	lev_t* lev;
+	struct reactor* reactor;
+	int ref;
+	int closed;
+	int header;
+	int batch;
+} lreactor_t;
+
 typedef struct lev_timer {
 	lev_t* lev;
 	struct ev_timer io;
@@ -95,6 +172,17 @@ typedef struct lev_timer {
 	struct lev_timer* next;
 } lev_timer_t;
 
+//时间轮定时器,node必须放第一个,到期回调里直接从node转回来
+//句柄不复用,挂在时间轮上时registry持有引用,空闲后交给gc,避免旧句柄指向新定时器
+typedef struct lcallout {
+	struct timer_node node;
+	lev_t* lev;
+	uint32_t freq;
+	int state;
+	int batch;
+	int ref;
+} lcallout_t;
+
 typedef struct lpipe_session {
 	lev_t* lev;
 	struct pipe_session* session;
@@ -159,6 +247,7 @@ tcp_session_create(lua_State* L, lev_t* lev,int fd,int header) {
 	ltcp_session->execute = 0;
 	ltcp_session->markdead = 0;
 	ltcp_session->threhold = MB;
+	ltcp_session->handoff = -1;
 
 	if (fd > 0) {
 		ltcp_session->session = ev_session_bind(lev->loop_ctx, fd);
@@ -173,7 +262,77 @@ static int
 tcp_session_release(ltcp_session_t* ltcp_session) {
 	lev_t* lev = ltcp_session->lev;
 	luaL_unref(lev->main, LUA_REGISTRYINDEX, ltcp_session->ref);
-	ev_session_free(ltcp_session->session);
+	if (ltcp_session->session) {
+		ev_session_free(ltcp_session->session);
+	}
+	free(ltcp_session->rest);
+	ltcp_session->rest = NULL;
+	return 0;
+}
+
+static inline void
+header_encode(char* data, int header, size_t size) {
+	int i;
+	for(i = 0;i < header;i++) {
+		data[i] = (size >> (i * 8)) & 0xff;
+	}
+}
+
+//把连接摘下来转交给另一个reactor,没读完的输入和没发完的输出一起带过去,只有reactor不存在时失败
+static int
+tcp_session_handoff(ltcp_session_t* ltcp_session) {
+	int id = ltcp_session->handoff;
+	ltcp_session->handoff = -1;
+	if (!reactor_exist(id)) {
+		free(ltcp_session->rest);
+		ltcp_session->rest = NULL;
+		ltcp_session->rest_size = 0;
+		return -1;
+	}
+
+	int fd = ev_session_fd(ltcp_session->session);
+	char addr[HOST_SIZE];
+	char ip[INET6_ADDRSTRLEN];
+	int port = 0;
+	if (get_peername(fd, ip, sizeof(ip), &port) == 0) {
+		snprintf(addr, HOST_SIZE, "%s:%d", ip, port);
+	} else {
+		snprintf(addr, HOST_SIZE, "ipc:unknown");
+	}
+
+	ev_detach_t detach;
+	ev_session_detach(ltcp_session->session, &detach);
+	ltcp_session->session = NULL;
+	ltcp_session->closed = 1;
+	luaL_unref(ltcp_session->lev->main, LUA_REGISTRYINDEX, ltcp_session->ref);
+
+	//批量里没处理的包和已经读掉包头的那个包,补回包头放在输入最前面
+	size_t prefix = ltcp_session->rest_size;
+	if (ltcp_session->header != 0 && ltcp_session->state == STATE_BODY) {
+		prefix += ltcp_session->header;
+	}
+	if (prefix > 0) {
+		char* input = malloc(prefix + detach.input_size);
+		if (ltcp_session->rest_size > 0) {
+			memcpy(input, ltcp_session->rest, ltcp_session->rest_size);
+		}
+		if (prefix > ltcp_session->rest_size) {
+			header_encode(input + ltcp_session->rest_size, ltcp_session->header, ltcp_session->need + ltcp_session->header);
+		}
+		if (detach.input_size > 0) {
+			memcpy(input + prefix, detach.input, detach.input_size);
+		}
+		free(detach.input);
+		detach.input = input;
+		detach.input_size += prefix;
+	}
+	free(ltcp_session->rest);
+	ltcp_session->rest = NULL;
+	ltcp_session->rest_size = 0;
+
+	if (reactor_handoff(id, &detach, addr) < 0) {
+		ev_detach_release(&detach);
+	}
 	return 0;
 }
 
@@ -196,6 +355,109 @@ tcp_session_error(struct ev_session* ev_session,void* ud) {
 	}
 }
 
+static inline lev_packet_t*
+batch_packet(lev_batch_t* batch) {
+	if (batch->count == batch->max) {
+		batch->max = batch->max == 0 ? 64 : batch->max * 2;
+		batch->packet = realloc(batch->packet, sizeof(*batch->packet) * batch->max);
+	}
+	return &batch->packet[batch->count++];
+}
+
+//整包和前面的包在同一个块里时只记下块内指针,批量回调结束后再统一drain
+static int
+batch_peek(lev_t* lev, struct ev_session* session, size_t size) {
+	lev_batch_t* batch = &lev->batch;
+	char* data = ev_session_peek(session, batch->peek + size);
+	if (!data) {
+		return -1;
+	}
+	lev_packet_t* packet = batch_packet(batch);
+	packet->data = data + batch->peek;
+	packet->size = size;
+	batch->peek += size;
+	return 0;
+}
+
+//包跨了块才拷进lev的批量缓冲,调用前输入里不能还有只记了指针的包
+static void
+batch_push(lev_t* lev, struct ev_session* session, size_t size) {
+	lev_batch_t* batch = &lev->batch;
+	assert(batch->peek == 0);
+	if (batch->size + size > batch->capacity) {
+		size_t capacity = batch->capacity == 0 ? THREAD_CACHED_SIZE : batch->capacity;
+		while (capacity < batch->size + size) {
+			capacity *= 2;
+		}
+		batch->buffer = realloc(batch->buffer, capacity);
+		batch->capacity = capacity;
+	}
+	ev_session_read(session, batch->buffer + batch->size, size);
+
+	lev_packet_t* packet = batch_packet(batch);
+	packet->data = NULL;
+	packet->offset = batch->size;
+	packet->size = size;
+	batch->size += size;
+}
+
+//回调里转交了,lua没取过的包补回包头存起来,转交时放在输入前面
+static void
+batch_rest(lev_t* lev, ltcp_session_t* ltcp_session) {
+	lev_batch_t* batch = &lev->batch;
+	size_t size = 0;
+	int i;
+	for(i = batch->cursor;i < batch->count;i++) {
+		size += ltcp_session->header + batch->packet[i].size;
+	}
+	char* rest = malloc(size);
+	size_t offset = 0;
+	for(i = batch->cursor;i < batch->count;i++) {
+		lev_packet_t* packet = &batch->packet[i];
+		header_encode(rest + offset, ltcp_session->header, packet->size + ltcp_session->header);
+		offset += ltcp_session->header;
+		memcpy(rest + offset, packet->data ? packet->data : batch->buffer + packet->offset, packet->size);
+		offset += packet->size;
+	}
+	ltcp_session->rest = rest;
+	ltcp_session->rest_size = size;
+}
+
+static void
+batch_flush(lev_t* lev, ltcp_session_t* ltcp_session) {
+	lev_batch_t* batch = &lev->batch;
+	if (batch->count == 0) {
+		return;
+	}
+	batch->owner = ltcp_session;
+	batch->cursor = 0;
+
+	lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev->callback);
+	lua_pushinteger(lev->main, LUA_EV_BATCH);
+	lua_rawgeti(lev->main, LUA_REGISTRYINDEX, ltcp_session->ref);
+	lua_pushinteger(lev->main, batch->count);
+	lua_pcall(lev->main, 3, 0, 0);
+
+	if (ltcp_session->handoff >= 0 && ltcp_session->markdead == 0 && batch->cursor < batch->count) {
+		batch_rest(lev, ltcp_session);
+	}
+	if (batch->peek > 0) {
+		ev_session_drain(ltcp_session->session, batch->peek);
+	}
+	batch->owner = NULL;
+	batch->count = 0;
+	batch->size = 0;
+	batch->peek = 0;
+}
+
+static void
+batch_release(lev_t* lev) {
+	lev_batch_t* batch = &lev->batch;
+	free(batch->buffer);
+	free(batch->packet);
+	memset(batch, 0, sizeof(*batch));
+}
+
 static void
 read_complete(struct ev_session* ev_session, void* ud) {
 	ltcp_session_t* ltcp_session = ud;
@@ -209,20 +471,31 @@ read_complete(struct ev_session* ev_session, void* ud) {
 		lua_rawgeti(lev->main, LUA_REGISTRYINDEX, ltcp_session->ref);
 		lua_pcall(lev->main, 2, 0, 0);
 	} else {
-		while(ltcp_session->markdead == 0) {
-			size_t len = ev_session_input_size(ltcp_session->session);
+		while(ltcp_session->markdead == 0 && ltcp_session->handoff < 0) {
+			size_t len = ev_session_input_size(ltcp_session->session) - lev->batch.peek;
 			if (ltcp_session->state == STATE_HEAD) {
 				if (len < ltcp_session->header)
 					break;
 
+				uint8_t buffer[HEADER_TYPE_DWORD];
+				uint8_t* header = buffer;
+				if (lev->batch.peek > 0) {
+					//前面还有只记了指针的包,包头不在同一个块里就先把这批交出去
+					char* data = ev_session_peek(ltcp_session->session, lev->batch.peek + ltcp_session->header);
+					if (!data) {
+						batch_flush(lev, ltcp_session);
+						continue;
+					}
+					header = (uint8_t*)data + lev->batch.peek;
+					lev->batch.peek += ltcp_session->header;
+				} else {
+					ev_session_read(ltcp_session->session,(char*)buffer,ltcp_session->header);
+				}
+
 				if (ltcp_session->header == HEADER_TYPE_WORD) {
-					uint8_t header[HEADER_TYPE_WORD];
-					ev_session_read(ltcp_session->session,(char*)header,HEADER_TYPE_WORD);
 					ltcp_session->need = header[0] | header[1] << 8;
 				} else {
 					assert(ltcp_session->header == HEADER_TYPE_DWORD);
-					uint8_t header[HEADER_TYPE_DWORD];
-					ev_session_read(ltcp_session->session,(char*)header,HEADER_TYPE_DWORD);
 					ltcp_session->need = header[0] | header[1] << 8 | header[2] << 16 | header[3] << 24;
 				}
 				ltcp_session->need -= ltcp_session->header;
@@ -235,10 +508,30 @@ read_complete(struct ev_session* ev_session, void* ud) {
 					tcp_session_error(ev_session, ud);
 					break;
 				}
-				
-				char* data = get_buffer(ltcp_session->need);
 
-				ev_session_read(ltcp_session->session,data,ltcp_session->need);
+				if (ltcp_session->batch) {
+					if (batch_peek(lev, ltcp_session->session, ltcp_session->need) < 0) {
+						if (lev->batch.peek > 0) {
+							batch_flush(lev, ltcp_session);
+							continue;
+						}
+						batch_push(lev, ltcp_session->session, ltcp_session->need);
+					}
+					ltcp_session->state = STATE_HEAD;
+					if (lev->batch.size + lev->batch.peek >= BATCH_FLUSH_SIZE) {
+						batch_flush(lev, ltcp_session);
+					}
+					continue;
+				}
+				
+				//整个包在同一个块里时直接把块内指针交给lua,回调结束后再回收
+				int copy = 0;
+				char* data = ev_session_peek(ltcp_session->session,ltcp_session->need);
+				if (!data) {
+					copy = 1;
+					data = get_buffer(ltcp_session->need);
+					ev_session_read(ltcp_session->session,data,ltcp_session->need);
+				}
 
 				lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev->callback);
 				lua_pushinteger(lev->main, LUA_EV_DATA);
@@ -249,7 +542,21 @@ read_complete(struct ev_session* ev_session, void* ud) {
 
 				ltcp_session->state = STATE_HEAD;
 
-				free_buffer(data);
+				if (copy) {
+					free_buffer(data);
+				} else {
+					ev_session_drain(ltcp_session->session,ltcp_session->need);
+				}
+			}
+		}
+
+		if (ltcp_session->batch) {
+			if (ltcp_session->markdead == 0) {
+				batch_flush(lev, ltcp_session);
+			} else {
+				lev->batch.count = 0;
+				lev->batch.size = 0;
+				lev->batch.peek = 0;
 			}
 		}
 	}
@@ -258,12 +565,47 @@ read_complete(struct ev_session* ev_session, void* ud) {
 
 	if (ltcp_session->markdead) {
 		tcp_session_release(ltcp_session);
+	} else if (ltcp_session->handoff >= 0) {
+		//reactor在这期间被释放了,连接留在当前循环继续用
+		if (tcp_session_handoff(ltcp_session) < 0) {
+			fprintf(stderr,"session:%p handoff error:reactor not exist\n",ltcp_session);
+		}
 	}
 }	
 
+//输出缓冲降到低水位以下
+static void
+write_complete(struct ev_session* ev_session, void* ud) {
+	ltcp_session_t* ltcp_session = ud;
+	if (ltcp_session->full == 0 || ev_session_output_size(ev_session) > ltcp_session->lowwater) {
+		return;
+	}
+	ltcp_session->full = 0;
+	if (ltcp_session->pause) {
+		ev_session_enable(ev_session, EV_READ);
+	}
+
+	lev_t* lev = ltcp_session->lev;
+	int execute = ltcp_session->execute;
+	ltcp_session->execute = 1;
+
+	lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev->callback);
+	lua_pushinteger(lev->main, LUA_EV_DRAIN);
+	lua_rawgeti(lev->main, LUA_REGISTRYINDEX, ltcp_session->ref);
+	lua_pcall(lev->main, 2, 0, 0);
+
+	ltcp_session->execute = execute;
+	if (execute == 0 && ltcp_session->markdead) {
+		tcp_session_release(ltcp_session);
+	}
+}
+
 static void
 close_complete(struct ev_session* ev_session, void* ud) {
 	ltcp_session_t* ltcp_session = ud;
+	if (ev_session_output_size(ev_session) > 0) {
+		return;
+	}
 	lev_t* lev = ltcp_session->lev;
 	assert(ltcp_session->closed == 1);
 
@@ -307,35 +649,79 @@ connect_complete(struct ev_session* session,void *userdata) {
 		lua_pushboolean(lev->main,1);
 		lua_rawgeti(lev->main, LUA_REGISTRYINDEX, ltcp_session->ref);
 
-		ev_session_setcb(ltcp_session->session,read_complete,NULL,tcp_session_error,ltcp_session);
+		ev_session_setcb(ltcp_session->session,read_complete,write_complete,tcp_session_error,ltcp_session);
 		ev_session_disable(ltcp_session->session,EV_WRITE);
 		ev_session_enable(ltcp_session->session,EV_READ);
 	}
 	lua_pcall(lev->main, 4, 0, 0);
 }
 
-static void 
-accept_complete(struct ev_listener *listener, int fd, const char* addr, void *ud) {
-	ltcp_listener_t* lev_listener = ud;
-	lev_t* lev = lev_listener->lev;
-
-	socket_nonblock(fd);
-	socket_no_delay(fd);
-	socket_keep_alive(fd);
-	socket_closeonexec(fd);
-
-	ltcp_session_t* ltcp_session = tcp_session_create(lev->main, lev, fd, lev_listener->header);
+static void
+accept_session(lev_t* lev, int owner, ev_detach_t* detach, const char* addr, int header, int batch) {
+	ltcp_session_t* ltcp_session = tcp_session_create(lev->main, lev, detach->fd, header);
+	ltcp_session->batch = batch;
+	ev_session_attach(ltcp_session->session, detach);
 
-	ev_session_setcb(ltcp_session->session,read_complete,NULL,tcp_session_error,ltcp_session);
+	ev_session_setcb(ltcp_session->session,read_complete,write_complete,tcp_session_error,ltcp_session);
 	ev_session_enable(ltcp_session->session,EV_READ);
 
 	lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev->callback);
 	lua_pushinteger(lev->main, LUA_EV_ACCEPT);
-	lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev_listener->ref);
+	lua_rawgeti(lev->main, LUA_REGISTRYINDEX, owner);
 	lua_pushvalue(lev->main,-4);
 	lua_pushstring(lev->main,addr);
 
 	lua_pcall(lev->main, 4, 0, 0);
+
+	//转交过来的连接带着没读完的数据,不用等下一次可读事件
+	if (ltcp_session->closed == 0 && ev_session_input_size(ltcp_session->session) > 0) {
+		read_complete(ltcp_session->session, ltcp_session);
+	}
+	lua_pop(lev->main, 1);
+}
+
+static inline uint32_t
+addr_hash(const char* addr) {
+	//只对ip部分做FNV-1a,同一来源总是落到同一个reactor
+	uint32_t hash = 2166136261u;
+	const char* sep = strrchr(addr, ':');
+	const char* end = sep ? sep : addr + strlen(addr);
+	for(;addr < end;addr++) {
+		hash ^= (uint8_t)*addr;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void 
+accept_complete(struct ev_listener *listener, int fd, const char* addr, void *ud) {
+	ltcp_listener_t* lev_listener = ud;
+	lev_t* lev = lev_listener->lev;
+
+	ev_detach_t detach;
+	memset(&detach, 0, sizeof(detach));
+	detach.fd = fd;
+
+	if (lev_listener->shard != SHARD_NONE) {
+		uint32_t key;
+		if (lev_listener->shard == SHARD_ROUND) {
+			key = lev_listener->cursor++;
+		} else {
+			key = addr_hash(addr);
+		}
+		int id = reactor_select(lev_listener->group, key);
+		if (id >= 0 && reactor_handoff(id, &detach, addr) == 0) {
+			return;
+		}
+	}
+
+	accept_session(lev, lev_listener->ref, &detach, addr, lev_listener->header, lev_listener->batch);
+}
+
+static void
+reactor_accept(struct reactor* reactor, struct ev_detach* detach, const char* addr, void *ud) {
+	lreactor_t* lreactor = ud;
+	accept_session(lreactor->lev, lreactor->ref, detach, addr, lreactor->header, lreactor->batch);
 }
 
 static inline ltcp_session_t* 
@@ -426,7 +812,7 @@ _connect(lua_State* L) {
 		ev_session_enable(ltcp_session->session,EV_WRITE);
 		lua_pushboolean(L,1);
 	} else {
-		ev_session_setcb(ltcp_session->session, read_complete, NULL, tcp_session_error, ltcp_session);
+		ev_session_setcb(ltcp_session->session, read_complete, write_complete, tcp_session_error, ltcp_session);
 		ev_session_enable(ltcp_session->session, EV_READ);
 	}
 	
@@ -439,7 +825,7 @@ _bind(lua_State* L) {
 	int fd = lua_tointeger(L, 2);
 	
 	ltcp_session_t* ltcp_session = tcp_session_create(L,lev,fd,0);
-	ev_session_setcb(ltcp_session->session, read_complete, NULL, tcp_session_error, ltcp_session);
+	ev_session_setcb(ltcp_session->session, read_complete, write_complete, tcp_session_error, ltcp_session);
 	ev_session_enable(ltcp_session->session, EV_READ);
 	return 1;
 }
@@ -519,6 +905,19 @@ _tcp_session_write(lua_State* L) {
 			ltcp_session->threhold -= MB;
 		}	
 	}
+
+	//超过高水位,通知lua暂停生产,等降到低水位再发LUA_EV_DRAIN
+	if (ltcp_session->highwater > 0 && ltcp_session->full == 0 && total >= ltcp_session->highwater) {
+		ltcp_session->full = 1;
+		if (ltcp_session->pause) {
+			ev_session_disable(ltcp_session->session, EV_READ);
+		}
+		lev_t* lev = ltcp_session->lev;
+		lua_rawgeti(L, LUA_REGISTRYINDEX, lev->callback);
+		lua_pushinteger(L, LUA_EV_FULL);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, ltcp_session->ref);
+		lua_pcall(L, 2, 0, 0);
+	}
 	lua_pushboolean(L,1);
 	
 	return 1;
@@ -569,6 +968,71 @@ _tcp_session_read_util(lua_State* L) {
 	return 1;
 }
 
+static int
+_tcp_session_read_budget(lua_State* L) {
+	ltcp_session_t* ltcp_session = get_tcp_session(L, 1);
+	int budget = luaL_checkinteger(L, 2);
+	ev_session_set_budget(ltcp_session->session, budget);
+	return 0;
+}
+
+static int
+_tcp_session_watermark(lua_State* L) {
+	ltcp_session_t* ltcp_session = get_tcp_session(L, 1);
+	size_t highwater = luaL_checkinteger(L, 2);
+	size_t lowwater = luaL_optinteger(L, 3, highwater / 2);
+	int pause = lua_toboolean(L, 4);
+	if (highwater > 0 && lowwater >= highwater) {
+		luaL_error(L, "session:%p watermark error:low:%d must less than high:%d", ltcp_session, (int)lowwater, (int)highwater);
+	}
+
+	ltcp_session->highwater = highwater;
+	ltcp_session->lowwater = lowwater;
+	ltcp_session->pause = pause;
+	if (highwater == 0 && ltcp_session->full) {
+		ltcp_session->full = 0;
+		ev_session_enable(ltcp_session->session, EV_READ);
+	}
+
+	ev_session_set_lowwater(ltcp_session->session, lowwater);
+	return 0;
+}
+
+static int
+_tcp_session_cork(lua_State* L) {
+	ltcp_session_t* ltcp_session = get_tcp_session(L, 1);
+	ev_session_set_cork(ltcp_session->session, lua_toboolean(L, 2));
+	return 0;
+}
+
+static int
+_tcp_session_batch(lua_State* L) {
+	ltcp_session_t* ltcp_session = get_tcp_session(L, 1);
+	if (ltcp_session->header == 0) {
+		luaL_error(L, "session:%p batch error:need header", ltcp_session);
+	}
+	ltcp_session->batch = lua_toboolean(L, 2);
+	return 0;
+}
+
+static int
+_tcp_session_packet(lua_State* L) {
+	ltcp_session_t* ltcp_session = (ltcp_session_t*)lua_touserdata(L, 1);
+	int index = luaL_checkinteger(L, 2);
+
+	lev_batch_t* batch = &ltcp_session->lev->batch;
+	if (batch->owner != ltcp_session || index < 1 || index > batch->count) {
+		return 0;
+	}
+	lev_packet_t* packet = &batch->packet[index - 1];
+	if (index > batch->cursor) {
+		batch->cursor = index;
+	}
+	lua_pushlightuserdata(L, packet->data ? packet->data : batch->buffer + packet->offset);
+	lua_pushinteger(L, packet->size);
+	return 2;
+}
+
 static int
 _tcp_session_alive(lua_State* L) {
 	ltcp_session_t* ltcp_session = (ltcp_session_t*)lua_touserdata(L, 1);
@@ -586,6 +1050,8 @@ _tcp_session_close(lua_State* L) {
 	ltcp_session->closed = 1;
 
 	if (!immediately) {
+		//低水位清零,否则没发完就会触发close_complete
+		ev_session_set_lowwater(ltcp_session->session, 0);
 		ev_session_setcb(ltcp_session->session, NULL, close_complete, tcp_session_error, ltcp_session);
 		ev_session_disable(ltcp_session->session, EV_READ);
 		ev_session_enable(ltcp_session->session, EV_WRITE);
@@ -600,6 +1066,36 @@ _tcp_session_close(lua_State* L) {
 	return 0;
 }
 
+//转交给id对应的reactor,在回调里调用时等本次读处理完再转交,没处理的包和没发完的数据一起带过去
+static int
+_tcp_session_handoff(lua_State* L) {
+	ltcp_session_t* ltcp_session = get_tcp_session(L, 1);
+	int id = luaL_checkinteger(L, 2);
+	if (id < 0) {
+		luaL_error(L, "session handoff error:invalid reactor id:%d", id);
+	}
+
+	if (!reactor_exist(id)) {
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, "reactor not exist");
+		return 2;
+	}
+
+	ltcp_session->handoff = id;
+	if (ltcp_session->execute) {
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+
+	if (tcp_session_handoff(ltcp_session) < 0) {
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, "reactor not exist");
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
 //-------------------------endof tcp session api---------------------------
 
 //-------------------------tcp listener api---------------------------
@@ -624,13 +1120,17 @@ _listen(lua_State* L) {
 	lev_listener->lev = lev;
 	lev_listener->closed = 0;
 	lev_listener->header = header;
+	lev_listener->batch = 0;
+	lev_listener->shard = SHARD_NONE;
+	lev_listener->cursor = 0;
+	lev_listener->group[0] = 0;
 
 	int flag = SOCKET_OPT_NOBLOCK | SOCKET_OPT_CLOSE_ON_EXEC | SOCKET_OPT_REUSEABLE_ADDR;
 	if (multi) {
 		flag |= SOCKET_OPT_REUSEABLE_PORT;
 	}
 
-	lev_listener->listener = ev_listener_bind(lev->loop_ctx,addr,len,16,flag,accept_complete,lev_listener);
+	lev_listener->listener = ev_listener_bind(lev->loop_ctx,addr,len,LISTEN_BACKLOG,flag,accept_complete,lev_listener);
 	if (!lev_listener->listener) {
 		lua_pushboolean(L, 0);
 		lua_pushstring(L, strdup(strerror(errno)));
@@ -674,6 +1174,27 @@ _listen_addr(lua_State* L) {
 	return 1;
 }
 
+static int
+_listen_batch(lua_State* L) {
+	ltcp_listener_t* lev_listener = (ltcp_listener_t*)lua_touserdata(L, 1);
+	if (lev_listener->header == 0) {
+		luaL_error(L, "listener batch error:need header");
+	}
+	lev_listener->batch = lua_toboolean(L, 2);
+	return 0;
+}
+
+//accept到的fd按轮询或者来源ip hash分给group里的reactor,group里没有reactor时留在本循环
+static int
+_listen_shard(lua_State* L) {
+	ltcp_listener_t* lev_listener = (ltcp_listener_t*)lua_touserdata(L, 1);
+	const char* group = luaL_checkstring(L, 2);
+	int hash = lua_toboolean(L, 3);
+	snprintf(lev_listener->group, sizeof(lev_listener->group), "%s", group);
+	lev_listener->shard = hash ? SHARD_HASH : SHARD_ROUND;
+	return 0;
+}
+
 static int
 _listen_close(lua_State* L) {
 	ltcp_listener_t* lev_listener = (ltcp_listener_t*)lua_touserdata(L, 1);
@@ -687,6 +1208,69 @@ _listen_close(lua_State* L) {
 }
 //-------------------------endof tcp listener api---------------------------
 
+//-------------------------reactor api---------------------------
+static int
+_reactor_new(lua_State* L) {
+	lev_t* lev = (lev_t*)lua_touserdata(L, 1);
+	const char* group = luaL_checkstring(L, 2);
+	int header = lua_tointeger(L, 3);
+	if (header != 0) {
+		if (header != HEADER_TYPE_WORD && header != HEADER_TYPE_DWORD) {
+			luaL_error(L,"create reactor error:error header size:%d",header);
+		}
+	}
+
+	lreactor_t* lreactor = lua_newuserdata(L, sizeof(*lreactor));
+	lreactor->lev = lev;
+	lreactor->closed = 0;
+	lreactor->header = header;
+	lreactor->batch = 0;
+	lreactor->reactor = reactor_create(lev->loop_ctx, group, reactor_accept, lreactor);
+	lreactor->ref = meta_init(L,META_REACTOR);
+
+	return 1;
+}
+
+static int
+_reactor_id(lua_State* L) {
+	lreactor_t* lreactor = (lreactor_t*)lua_touserdata(L, 1);
+	if (lreactor->closed) {
+		return 0;
+	}
+	lua_pushinteger(L, reactor_id(lreactor->reactor));
+	return 1;
+}
+
+static int
+_reactor_alive(lua_State* L) {
+	lreactor_t* lreactor = (lreactor_t*)lua_touserdata(L, 1);
+	lua_pushboolean(L,lreactor->closed == 0);
+	return 1;
+}
+
+static int
+_reactor_batch(lua_State* L) {
+	lreactor_t* lreactor = (lreactor_t*)lua_touserdata(L, 1);
+	if (lreactor->header == 0) {
+		luaL_error(L, "reactor batch error:need header");
+	}
+	lreactor->batch = lua_toboolean(L, 2);
+	return 0;
+}
+
+static int
+_reactor_close(lua_State* L) {
+	lreactor_t* lreactor = (lreactor_t*)lua_touserdata(L, 1);
+	if (lreactor->closed)
+		luaL_error(L, "reactor alreay closed");
+
+	lreactor->closed = 1;
+	luaL_unref(L, LUA_REGISTRYINDEX, lreactor->ref);
+	reactor_release(lreactor->reactor);
+	return 0;
+}
+//-------------------------endof reactor api---------------------------
+
 //-------------------------timer api---------------------------
 
 static void
@@ -752,6 +1336,197 @@ _timer_alive(lua_State* L) {
 }
 //-------------------------endof timer api---------------------------
 
+//-------------------------callout api---------------------------
+
+//tick从创建时间轮时开始算,绝对时间除以10ms会超出uint32
+//时间往回走时重新定基准,时间轮那边会把current对齐过来
+static inline uint32_t
+wheel_now(lev_t* lev) {
+	double elapse = loop_ctx_now(lev->loop_ctx) - lev->wheel_base;
+	if (elapse < 0) {
+		lev->wheel_base = loop_ctx_now(lev->loop_ctx);
+		return 0;
+	}
+	return (uint32_t)(uint64_t)(elapse / WHEEL_TICK);
+}
+
+static void
+callout_expire(struct timer_node* node, void* ud) {
+	lev_t* lev = ud;
+	lcallout_t* callout = (lcallout_t*)node;
+
+	if (callout->freq > 0) {
+		timer_wheel_add(lev->wheel, node, callout->freq);
+	} else {
+		callout->state = CALLOUT_EXPIRED;
+	}
+	callout->batch = 1;
+
+	if (lev->expired_count == lev->expired_max) {
+		lev->expired_max = lev->expired_max == 0 ? 64 : lev->expired_max * 2;
+		lev->expired = realloc(lev->expired, sizeof(*lev->expired) * lev->expired_max);
+	}
+	lev->expired[lev->expired_count++] = callout;
+}
+
+static inline void
+callout_unref(lev_t* lev, lcallout_t* callout) {
+	luaL_unref(lev->main, LUA_REGISTRYINDEX, callout->ref);
+	callout->ref = LUA_NOREF;
+}
+
+//一个tick里到期的定时器放进同一张表,一次回调给lua
+static void
+wheel_tick(struct ev_loop* loop,struct ev_timer* io,int revents) {
+	lev_t* lev = io->data;
+
+	lev->expired_count = 0;
+	timer_wheel_update(lev->wheel, wheel_now(lev), callout_expire, lev);
+
+	if (lev->expired_count > 0) {
+		lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev->expired_ref);
+		int i;
+		for(i = 0;i < lev->expired_count;i++) {
+			lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev->expired[i]->ref);
+			lua_rawseti(lev->main, -2, i + 1);
+		}
+		lua_pop(lev->main, 1);
+
+		lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev->callback);
+		lua_pushinteger(lev->main, LUA_EV_CALLOUT);
+		lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev->expired_ref);
+		lua_pushinteger(lev->main, lev->expired_count);
+		lua_pcall(lev->main, 3, 0, 0);
+
+		//回调期间取消的定时器等这里统一释放引用,批次表里还要用到它们
+		for(i = 0;i < lev->expired_count;i++) {
+			lcallout_t* callout = lev->expired[i];
+			if (callout->batch == 0) {
+				continue;
+			}
+			callout->batch = 0;
+			if (callout->state != CALLOUT_PENDING) {
+				callout->state = CALLOUT_IDLE;
+				callout_unref(lev, callout);
+			}
+		}
+
+		//批次表清掉,不让它拖住已经释放的句柄
+		lua_rawgeti(lev->main, LUA_REGISTRYINDEX, lev->expired_ref);
+		for(i = 0;i < lev->expired_count;i++) {
+			lua_pushnil(lev->main);
+			lua_rawseti(lev->main, -2, i + 1);
+		}
+		lua_pop(lev->main, 1);
+		lev->expired_count = 0;
+	}
+
+	if (timer_wheel_count(lev->wheel) == 0) {
+		ev_timer_stop(loop, io);
+	}
+}
+
+//秒数换成tick,负数当0,超过uint32能表示的范围就截断
+static inline uint32_t
+wheel_ticks(double ti) {
+	if (ti <= 0) {
+		return 0;
+	}
+	double ticks = ti / WHEEL_TICK + 0.5;
+	if (ticks >= (double)UINT32_MAX) {
+		return UINT32_MAX;
+	}
+	return (uint32_t)ticks;
+}
+
+static int
+_callout(lua_State* L) {
+	lev_t* lev = (lev_t*)lua_touserdata(L, 1);
+
+	double ti = luaL_checknumber(L, 2);
+	luaL_argcheck(L, ti == ti, 2, "time is nan");
+	double freq = 0;
+	if (!lua_isnoneornil(L, 3)) {
+		freq = luaL_checknumber(L, 3);
+		luaL_argcheck(L, freq == freq, 3, "freq is nan");
+	}
+
+	if (!lev->wheel) {
+		lev->wheel_base = loop_ctx_now(lev->loop_ctx);
+		lev->wheel = timer_wheel_create(wheel_now(lev));
+		lev->ticker.data = lev;
+		ev_timer_init(&lev->ticker, wheel_tick, WHEEL_TICK, WHEEL_TICK);
+		lua_newtable(L);
+		lev->expired_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+
+	lcallout_t* callout = lua_newuserdata(L, sizeof(*callout));
+	memset(callout, 0, sizeof(*callout));
+	callout->lev = lev;
+	callout->ref = meta_init(L,META_CALLOUT);
+
+	callout->state = CALLOUT_PENDING;
+	callout->freq = wheel_ticks(freq);
+	if (freq > 0 && callout->freq == 0) {
+		callout->freq = 1;
+	}
+	//ticker停着的时候时间轮没有推进,先对齐到现在再挂,否则下一个tick会把空闲的时间一次补上
+	if (!ev_is_active(&lev->ticker)) {
+		timer_wheel_update(lev->wheel, wheel_now(lev), callout_expire, lev);
+	}
+
+	timer_wheel_add(lev->wheel, &callout->node, wheel_ticks(ti));
+
+	if (!ev_is_active(&lev->ticker)) {
+		ev_timer_start(loop_ctx_get(lev->loop_ctx), &lev->ticker);
+	}
+
+	return 1;
+}
+
+static int
+_callout_cancel(lua_State* L) {
+	lcallout_t* callout = (lcallout_t*)lua_touserdata(L, 1);
+	if (callout->state == CALLOUT_IDLE) {
+		lua_pushboolean(L, 0);
+		lua_pushliteral(L, "timer already cancel");
+		return 2;
+	}
+	lev_t* lev = callout->lev;
+	timer_wheel_remove(lev->wheel, &callout->node);
+	callout->state = CALLOUT_IDLE;
+	if (!callout->batch) {
+		callout_unref(lev, callout);
+	}
+
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+static int
+_callout_alive(lua_State* L) {
+	lcallout_t* callout = (lcallout_t*)lua_touserdata(L, 1);
+	lua_pushboolean(L, callout->state != CALLOUT_IDLE);
+	return 1;
+}
+
+static void
+callout_release(lev_t* lev) {
+	if (!lev->wheel) {
+		return;
+	}
+	ev_timer_stop(loop_ctx_get(lev->loop_ctx), &lev->ticker);
+	timer_wheel_release(lev->wheel);
+	lev->wheel = NULL;
+
+	free(lev->expired);
+	lev->expired = NULL;
+	lev->expired_count = lev->expired_max = 0;
+
+	luaL_unref(lev->main, LUA_REGISTRYINDEX, lev->expired_ref);
+}
+//-------------------------endof callout api---------------------------
+
 //-------------------------udp api---------------------------
 
 static void
@@ -929,7 +1704,7 @@ _lpipe_new(lua_State* L) {
 	lpipe->ref = meta_init(L, META_PIPE);
 	pipe_session_setcb(session, pipe_recv, lpipe);
 
-	lua_pushinteger(L, pipe_session_write_fd(session));
+	lua_pushlightuserdata(L, pipe_session_channel(session));
 
 	return 2;
 }
@@ -1099,7 +1874,7 @@ _ldns_resolve(lua_State* L) {
 }
 //-------------------------event api---------------------------
 
-extern int lgate_create(lua_State* L, struct ev_loop_ctx* loop_ctx, uint32_t max_client, uint32_t max_freq, uint32_t timeout);
+extern int lgate_create(lua_State* L, struct ev_loop_ctx* loop_ctx, uint32_t max_client, uint32_t max_freq, uint32_t timeout, uint32_t compress, uint32_t threads);
 
 static int
 _lgate_new(lua_State* L) {
@@ -1107,10 +1882,15 @@ _lgate_new(lua_State* L) {
 	uint32_t max_client = luaL_optinteger(L, 2, 1000);
 	uint32_t max_freq = luaL_optinteger(L, 3, 1000);
 	uint32_t timeout = luaL_optinteger(L, 4, 60);
+	uint32_t threads = luaL_optinteger(L, 5, 0);
+	uint32_t compress = luaL_optinteger(L, 6, 0);
 	if (max_client <= 0 || max_client >= 10000) {
 		luaL_error(L,"error create gate,size invalid:%d",max_client);
 	}
-	return lgate_create(L,lev->loop_ctx,max_client,max_freq,timeout);
+	if (threads > 64) {
+		luaL_error(L,"error create gate,threads invalid:%d",threads);
+	}
+	return lgate_create(L,lev->loop_ctx,max_client,max_freq,timeout,compress,threads);
 }
 
 static int
@@ -1125,7 +1905,9 @@ _release(lua_State* L) {
 	lev_t* lev = (lev_t*)lua_touserdata(L, 1);
 	http_multi_delete(lev->multi);
 	dns_resolver_delete(lev->resolver);
+	callout_release(lev);
 	loop_ctx_release(lev->loop_ctx);
+	batch_release(lev);
 	luaL_unref(L, LUA_REGISTRYINDEX, lev->ref);
 	return 0;
 }
@@ -1140,7 +1922,9 @@ _break(lua_State* L) {
 static int
 _clean(lua_State* L) {
 	lev_t* lev = (lev_t*)lua_touserdata(L, 1);
+	callout_release(lev);
 	loop_ctx_clean(lev->loop_ctx);
+	batch_release(lev);
 	while(lev->freelist) {
 		lev_timer_t* timer = lev->freelist;
 		lev->freelist = lev->freelist->next;
@@ -1170,6 +1954,11 @@ _event_new(lua_State* L) {
 	lev->main = L;
 	lev->callback = callback;
 	lev->freelist = NULL;
+	memset(&lev->batch, 0, sizeof(lev->batch));
+	lev->wheel = NULL;
+	lev->expired = NULL;
+	lev->expired_count = lev->expired_max = 0;
+	lev->expired_ref = LUA_NOREF;
 	lev->ref = meta_init(L,META_EVENT);
 
 	return 1;
@@ -1182,9 +1971,11 @@ luaopen_ev_core(lua_State* L) {
 	luaL_newmetatable(L, META_EVENT);
 	const luaL_Reg meta_event[] = {
 		{ "listen", _listen },
+		{ "reactor", _reactor_new },
 		{ "connect", _connect },
 		{ "bind", _bind },
 		{ "timer", _timer },
+		{ "callout", _callout },
 		{ "udp", _udp_session_new },
 		{ "pipe", _lpipe_new },
 		{ "gate", _lgate_new },
@@ -1206,6 +1997,12 @@ luaopen_ev_core(lua_State* L) {
 		{ "write", _tcp_session_write },
 		{ "read", _tcp_session_read },
 		{ "read_util", _tcp_session_read_util },
+		{ "read_budget", _tcp_session_read_budget },
+		{ "batch", _tcp_session_batch },
+		{ "cork", _tcp_session_cork },
+		{ "watermark", _tcp_session_watermark },
+		{ "packet", _tcp_session_packet },
+		{ "handoff", _tcp_session_handoff },
 		{ "alive", _tcp_session_alive },
 		{ "close", _tcp_session_close },
 		{ NULL, NULL },
@@ -1218,6 +2015,8 @@ luaopen_ev_core(lua_State* L) {
 	const luaL_Reg meta_listener[] = {
 		{ "alive", _listen_alive },
 		{ "addr", _listen_addr },
+		{ "batch", _listen_batch },
+		{ "shard", _listen_shard },
 		{ "close", _listen_close },
 		{ NULL, NULL },
 	};
@@ -1225,6 +2024,18 @@ luaopen_ev_core(lua_State* L) {
 	lua_setfield(L, -2, "__index");
 	lua_pop(L,1);
 
+	luaL_newmetatable(L, META_REACTOR);
+	const luaL_Reg meta_reactor[] = {
+		{ "id", _reactor_id },
+		{ "alive", _reactor_alive },
+		{ "batch", _reactor_batch },
+		{ "close", _reactor_close },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,meta_reactor);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L,1);
+
 	luaL_newmetatable(L, META_TIMER);
 	const luaL_Reg meta_timer[] = {
 		{ "cancel", _timer_cancel },
@@ -1235,6 +2046,16 @@ luaopen_ev_core(lua_State* L) {
 	lua_setfield(L, -2, "__index");
 	lua_pop(L,1);
 
+	luaL_newmetatable(L, META_CALLOUT);
+	const luaL_Reg meta_callout[] = {
+		{ "cancel", _callout_cancel },
+		{ "alive", _callout_alive },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,meta_callout);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L,1);
+
 	luaL_newmetatable(L, META_UDP);
 	const luaL_Reg meta_udp[] = {
 		{ "send", _udp_session_send },
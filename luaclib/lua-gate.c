@@ -13,6 +13,8 @@
 
 #include "socket/gate.h"
 
+#define BROADCAST_CACHED 1024
+
 struct lgate_ctx {
 	gate_t* gate;
 	int alive;
@@ -98,6 +100,38 @@ lgate_close(lua_State* L) {
 	return 0;
 }
 
+static int
+lgate_aggregate(lua_State* L) {
+	struct lgate_ctx* lgate = lua_touserdata(L, 1);
+	luaL_checktype(L, 2, LUA_TBOOLEAN);
+	gate_aggregate(lgate->gate, lua_toboolean(L, 2));
+	return 0;
+}
+
+static int
+lgate_limit(lua_State* L) {
+	struct lgate_ctx* lgate = lua_touserdata(L, 1);
+	uint32_t rate = luaL_checkinteger(L, 2);
+	uint32_t burst = luaL_optinteger(L, 3, rate);
+	gate_limit(lgate->gate, rate, burst);
+	return 0;
+}
+
+static int
+lgate_cost(lua_State* L) {
+	struct lgate_ctx* lgate = lua_touserdata(L, 1);
+	int message_id = luaL_checkinteger(L, 2);
+	int cost = luaL_checkinteger(L, 3);
+	if (message_id < 0 || message_id > 0xffff) {
+		luaL_error(L, "gate cost error:message id invalid:%d", message_id);
+	}
+	if (cost < 0 || cost > 0xff) {
+		luaL_error(L, "gate cost error:cost invalid:%d", cost);
+	}
+	gate_cost(lgate->gate, message_id, cost);
+	return 0;
+}
+
 static int
 lgate_send(lua_State* L) {
 	struct lgate_ctx* lgate = lua_touserdata(L, 1);
@@ -135,6 +169,124 @@ lgate_send(lua_State* L) {
     return 0;
 }
 
+static int
+lgate_broadcast(lua_State* L) {
+	struct lgate_ctx* lgate = lua_touserdata(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int message_id = luaL_checkinteger(L, 3);
+
+	size_t size;
+	void* data = NULL;
+	int vt = lua_type(L, 4);
+	switch(vt) {
+		case LUA_TSTRING: {
+			data = (void*)lua_tolstring(L, 4, &size);
+			break;
+		}
+		case LUA_TLIGHTUSERDATA:{
+			data = lua_touserdata(L, 4);
+			size = lua_tointeger(L, 5);
+			break;
+		}
+		default:
+			luaL_error(L,"lgate broadcast error:unkown type:%s",lua_typename(L,vt));
+	}
+
+	if (size == 0) {
+		luaL_error(L,"lgate broadcast error:size is zero");
+	}
+
+	uint32_t cached[BROADCAST_CACHED];
+	uint32_t* ids = cached;
+	int count = lua_rawlen(L, 2);
+	if (count > BROADCAST_CACHED) {
+		ids = malloc(sizeof(uint32_t) * count);
+	}
+	int i;
+	for(i = 0;i < count;i++) {
+		lua_rawgeti(L, 2, i + 1);
+		ids[i] = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+
+	int sent = gate_multicast(lgate->gate,ids,count,message_id,data,size);
+
+	if (ids != cached) {
+		free(ids);
+	}
+	if (vt == LUA_TLIGHTUSERDATA) {
+		free(data);
+	}
+	lua_pushinteger(L, sent);
+	return 1;
+}
+
+static inline void
+set_field(lua_State* L,const char* name,uint64_t value) {
+	lua_pushinteger(L, value);
+	lua_setfield(L, -2, name);
+}
+
+static int
+lgate_stats(lua_State* L) {
+	struct lgate_ctx* lgate = lua_touserdata(L, 1);
+
+	struct gate_stats* stats = malloc(sizeof(*stats));
+	memset(stats, 0, sizeof(*stats));
+	gate_stats(lgate->gate, stats);
+
+	lua_newtable(L);
+	set_field(L, "bytes_in", stats->bytes_in);
+	set_field(L, "bytes_out", stats->bytes_out);
+	set_field(L, "messages_in", stats->messages_in);
+	set_field(L, "messages_out", stats->messages_out);
+	set_field(L, "accept", stats->accept);
+	set_field(L, "reject", stats->reject);
+	set_field(L, "accept_rate", stats->accept_rate);
+	set_field(L, "drop", stats->drop);
+
+	lua_newtable(L);
+	set_field(L, "error", stats->kick[GATE_KICK_ERROR]);
+	set_field(L, "size", stats->kick[GATE_KICK_SIZE]);
+	set_field(L, "decrypt", stats->kick[GATE_KICK_DECRYPT]);
+	set_field(L, "freq", stats->kick[GATE_KICK_FREQ]);
+	set_field(L, "timeout", stats->kick[GATE_KICK_TIMEOUT]);
+	set_field(L, "close", stats->kick[GATE_KICK_CLOSE]);
+	lua_setfield(L, -2, "kick");
+
+	//output[i]: 发送后输出队列长度落在[2^(i-1)kb,2^i kb)的次数
+	lua_createtable(L, GATE_STATS_OUTPUT, 0);
+	int i;
+	for(i = 0;i < GATE_STATS_OUTPUT;i++) {
+		lua_pushinteger(L, stats->output[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "output");
+
+	//只返回有流量的消息id,超出统计范围的id汇总在other里
+	lua_newtable(L);
+	for(i = 0;i <= GATE_STATS_MESSAGE;i++) {
+		struct gate_message_stats* message = &stats->message[i];
+		if (message->in_count == 0 && message->out_count == 0) {
+			continue;
+		}
+		lua_createtable(L, 0, 4);
+		set_field(L, "in_count", message->in_count);
+		set_field(L, "in_bytes", message->in_bytes);
+		set_field(L, "out_count", message->out_count);
+		set_field(L, "out_bytes", message->out_bytes);
+		if (i == GATE_STATS_MESSAGE) {
+			lua_setfield(L, -2, "other");
+		} else {
+			lua_rawseti(L, -2, i);
+		}
+	}
+	lua_setfield(L, -2, "message");
+
+	free(stats);
+	return 1;
+}
+
 static int
 lgate_callback(lua_State* L) {
 	struct lgate_ctx* lgate = lua_touserdata(L, 1);
@@ -175,11 +327,21 @@ lgate_release(lua_State* L) {
 }
 
 int
-lgate_create(lua_State* L, struct ev_loop_ctx* loop_ctx, uint32_t max_client, uint32_t max_freq, uint32_t timeout) {
+lgate_create(lua_State* L, struct ev_loop_ctx* loop_ctx, uint32_t max_client, uint32_t max_freq, uint32_t timeout, uint32_t compress, uint32_t threads) {
 	struct lgate_ctx* lgate = lua_newuserdata(L, sizeof(*lgate));
 	memset(lgate, 0, sizeof(*lgate));
 
-	lgate->gate = gate_create(loop_ctx, max_client, max_freq, timeout, lgate);
+	if (threads > 0) {
+		lgate->gate = gate_create_threaded(loop_ctx, max_client, max_freq, timeout, compress, threads, lgate);
+	} else {
+		lgate->gate = gate_create(loop_ctx, max_client, max_freq, timeout, compress, lgate);
+	}
+	if (!lgate->gate) {
+		lua_pop(L, 1);
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, "gate create failed");
+		return 2;
+	}
 	lgate->alive = 1;    
 	lgate->L = G(L)->mainthread;
 
@@ -189,6 +351,11 @@ lgate_create(lua_State* L, struct ev_loop_ctx* loop_ctx, uint32_t max_client, ui
             { "stop", lgate_stop },
             { "close", lgate_close },
             { "send", lgate_send },
+            { "broadcast", lgate_broadcast },
+            { "aggregate", lgate_aggregate },
+            { "stats", lgate_stats },
+            { "limit", lgate_limit },
+            { "cost", lgate_cost },
             { "release", lgate_release },
             { "set_callback", lgate_callback },
             { NULL, NULL },
@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+
+#include "common/name_table.h"
+
+//worker和tp共用的名字表接口,表只在这个模块里有一份,整个进程共享
+
+static int
+lname_id(lua_State* L) {
+	size_t size;
+	const char* name = luaL_checklstring(L, 1, &size);
+	int id = name_table_id(name, size);
+	if (id < 0) {
+		luaL_error(L, "name table full:%s,only static file and method names allowed", name);
+	}
+	lua_pushinteger(L, id);
+	return 1;
+}
+
+static int
+lname_str(lua_State* L) {
+	size_t size;
+	const char* name = name_table_name(luaL_checkinteger(L, 1), &size);
+	if (!name) {
+		return 0;
+	}
+	lua_pushlstring(L, name, size);
+	return 1;
+}
+
+int
+luaopen_name_core(lua_State* L) {
+	const luaL_Reg l[] = {
+		{ "id", lname_id },
+		{ "str", lname_str },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L, l);
+	return 1;
+}
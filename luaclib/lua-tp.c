@@ -21,7 +21,7 @@
 
 typedef struct thread_ctx {
 	int index;
-	int fd;
+	struct pipe_channel* channel;
 	
 	int ref;
 	int callback;
@@ -33,7 +33,7 @@ typedef struct thread_ctx {
 
 typedef struct lthread_pool {
 	struct thread_pool* core;
-	int fd;
+	struct pipe_channel* channel;
 	char* boot_param;
 	sem_t sem;
 	int count;
@@ -46,14 +46,7 @@ int load_helper(lua_State *L);
 
 static inline void
 tp_do_send_pipe(thread_ctx_t* ctx) {
-	while(ctx->first) {
-		struct pipe_message* message = ctx->first;
-		struct pipe_message* next_message = message->next;
-		if (socket_pipe_write(ctx->fd, (void*)&message, sizeof(void*)) < 0) {
-			return;
-		}
-		ctx->first = next_message;
-	}
+	pipe_channel_push(ctx->channel, ctx->first);
 	ctx->first = ctx->last = NULL;
 }
 
@@ -126,7 +119,7 @@ tp_init(struct thread_pool* pool, int index, void* ud) {
 	memset(ctx,0,sizeof(*ctx));
 
 	ctx->index = index;
-	ctx->fd = ltp->fd;
+	ctx->channel = ltp->channel;
 	ctx->L = L;
 	ctx->callback = 0;
 
@@ -155,35 +148,53 @@ tp_fina(struct thread_pool* pool, int index, void* ud) {
 	lua_close(ctx->L);
 }
 
-static int
-ltp_push(lua_State* L) {
-	lthread_pool_t* ltp = lua_touserdata(L, 1);
-	int session = lua_tointeger(L, 2);
-
+static inline void*
+ltp_pack(lua_State* L, int index, size_t* size) {
 	void* data = NULL;
-	size_t size = 0;
-
-	switch(lua_type(L, 3)) {
+	switch(lua_type(L, index)) {
 		case LUA_TSTRING: {
-			const char* str = lua_tolstring(L, 3, &size);
-			data = malloc(size);
-			memcpy(data,str,size);
+			const char* str = lua_tolstring(L, index, size);
+			data = malloc(*size);
+			memcpy(data,str,*size);
 			break;
 		}
 		case LUA_TLIGHTUSERDATA:{
-			data = lua_touserdata(L, 3);
-			size = lua_tointeger(L, 4);
+			data = lua_touserdata(L, index);
+			*size = lua_tointeger(L, index + 1);
 			break;
 		}
 		default: {
-			luaL_error(L, "unkown type:%s", lua_typename(L, lua_type(L, 3)));
+			luaL_error(L, "unkown type:%s", lua_typename(L, lua_type(L, index)));
 		}
 	}
+	return data;
+}
+
+static int
+ltp_push(lua_State* L) {
+	lthread_pool_t* ltp = lua_touserdata(L, 1);
+	int session = lua_tointeger(L, 2);
+
+	size_t size = 0;
+	void* data = ltp_pack(L, 3, &size);
 
 	thread_pool_push_task(ltp->core, tp_consumer, session, data, size);
 	return 0;
 }
 
+static int
+ltp_push_affinity(lua_State* L) {
+	lthread_pool_t* ltp = lua_touserdata(L, 1);
+	uint32_t key = (uint32_t)luaL_checkinteger(L, 2);
+	int session = lua_tointeger(L, 3);
+
+	size_t size = 0;
+	void* data = ltp_pack(L, 4, &size);
+
+	thread_pool_push_affinity(ltp->core, key, tp_consumer, session, data, size);
+	return 0;
+}
+
 static int
 ltp_release(lua_State* L) {
 	lthread_pool_t* ltp = lua_touserdata(L, 1);
@@ -204,7 +215,8 @@ ltp_release(lua_State* L) {
 
 static int
 lcreate(lua_State* L) {
-	int fd = luaL_checkinteger(L, 1);
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	struct pipe_channel* channel = lua_touserdata(L, 1);
 	int count = luaL_checkinteger(L, 2);
 	const char* boot_param = luaL_checkstring(L, 3);
 
@@ -213,6 +225,7 @@ lcreate(lua_State* L) {
 	if (luaL_newmetatable(L, "meta_tp")) {
         const luaL_Reg meta[] = {
             { "push", ltp_push },
+            { "push_affinity", ltp_push_affinity },
 			{ NULL, NULL },
         };
         luaL_newlib(L, meta);
@@ -224,7 +237,7 @@ lcreate(lua_State* L) {
     lua_setmetatable(L, -2);
 
 	ltp->core = thread_pool_create(tp_init, tp_fina, tp_wakeup, ltp);
-	ltp->fd = fd;
+	ltp->channel = channel;
 	ltp->boot_param = strdup(boot_param);
 	ltp->count = count;
 	ltp->slots = malloc(ltp->count * sizeof(*ltp->slots));
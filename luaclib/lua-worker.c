@@ -19,15 +19,15 @@
 #include "socket/socket_pipe.h"
 #include "socket/socket_util.h"
 
+#define META_BUFFER "meta_worker_buffer"
+
 struct startup_args {
-	int fd;
+	struct pipe_channel* channel;
 	char* args;
 	sem_t sem;
 };
 
 typedef struct workder_ctx {
-	mutex_t mutex;
-	cond_t cond;
 	struct message_queue* queue;
 	int id;
 	int quit;
@@ -36,11 +36,17 @@ typedef struct workder_ctx {
 
 	lua_State* L;
 
-	int fd;
+	struct pipe_channel* channel;
 	struct pipe_message* first;
 	struct pipe_message* last;
 } worker_ctx_t;
 
+//只能移动的消息内存,push之后指针交给对端线程,本地句柄作废
+typedef struct worker_buffer {
+	void* data;
+	size_t size;
+} worker_buffer_t;
+
 typedef struct worker_manager {
 	mutex_t mutex;
 	int size;
@@ -104,8 +110,11 @@ delete_worker(int id) {
 
 worker_ctx_t*
 worker_ref(int id) {
+	if (!_MANAGER || id < 0) {
+		return NULL;
+	}
 	mutex_lock(&_MANAGER->mutex);
-	worker_ctx_t* ctx = _MANAGER->slot[id];
+	worker_ctx_t* ctx = id < _MANAGER->size ? _MANAGER->slot[id] : NULL;
 	if (ctx) {
 		__sync_add_and_fetch(&ctx->ref,1);
 	}
@@ -127,9 +136,6 @@ worker_ctx_t*
 worker_create() {
 	worker_ctx_t* worker_ctx = malloc(sizeof(*worker_ctx));
 	memset(worker_ctx,0,sizeof(*worker_ctx));
-	
-	mutex_init(&worker_ctx->mutex);
-	cond_init(&worker_ctx->cond);
 
 	worker_ctx->id = -1;
 	worker_ctx->quit = 0;
@@ -149,8 +155,6 @@ workder_quit(worker_ctx_t* ctx) {
 void
 worker_release(worker_ctx_t* ctx) {
 	queue_free(ctx->queue);
-	mutex_destroy(&ctx->mutex);
-	cond_destroy(&ctx->cond);
 	while(ctx->first) {
 		struct pipe_message* message = ctx->first;
 		ctx->first = ctx->first->next;
@@ -163,14 +167,8 @@ worker_release(worker_ctx_t* ctx) {
 
 int
 worker_send_pipe(worker_ctx_t* ctx) {
-	while(ctx->first) {
-		struct pipe_message* message = ctx->first;
-		struct pipe_message* next_message = message->next;
-		if (socket_pipe_write(ctx->fd, (void*)&message, sizeof(void*)) < 0) {
-			return -1;
-		}
-		ctx->first = next_message;
-	}
+	//整条链一次推给主线程,只在主线程空闲时才敲门铃
+	pipe_channel_push(ctx->channel, ctx->first);
 	ctx->first = ctx->last = NULL;
 	return 0;
 }
@@ -183,10 +181,6 @@ worker_push(int target,int source,int session,void* data,size_t size) {
 	}
 
 	queue_push(target_ctx->queue,source,session,data,size);
-	if (!mutex_trylock(&target_ctx->mutex)) {
-		cond_notify_one(&target_ctx->cond);
-		mutex_unlock(&target_ctx->mutex);
-	}
 
 	worker_unref(target_ctx);
 	return 0;
@@ -214,11 +208,8 @@ worker_dispatch(worker_ctx_t* ctx) {
 	for(;;) {
 		struct queue_message* message = queue_pop(queue_ctx,ctx->id);
 		if (message == NULL) {
-			mutex_lock(&ctx->mutex);
-			
-			cond_timed_wait(&ctx->cond,&ctx->mutex,10);
-
-			mutex_unlock(&ctx->mutex);
+			//没消息就睡在队列的门铃上
+			queue_wait(queue_ctx, -1);
 
 			worker_send_pipe(ctx);
 		} else {
@@ -236,35 +227,154 @@ worker_dispatch(worker_ctx_t* ctx) {
 
 extern int load_helper(lua_State *L);
 
-int
-module_push(lua_State* L) {
-	worker_ctx_t* ctx = lua_touserdata(L, 1);
-	int target = lua_tointeger(L,2);
-	int session = lua_tointeger(L,3);
+//字符串要拷贝一份,lightuserdata和buffer直接转移所有权
+//buffer在真正投递成功后才作废,投递失败时句柄还能继续用
+static inline void*
+message_data(lua_State* L, int index, size_t* size, worker_buffer_t** buffer) {
+	void* data = NULL;
+	*buffer = NULL;
+	switch(lua_type(L, index)) {
+		case LUA_TSTRING: {
+			const char* str = lua_tolstring(L, index, size);
+			data = malloc(*size);
+			memcpy(data,str,*size);
+			break;
+		}
+		case LUA_TLIGHTUSERDATA:{
+			data = lua_touserdata(L, index);
+			*size = lua_tointeger(L, index + 1);
+			break;
+		}
+		case LUA_TUSERDATA:{
+			worker_buffer_t* wb = luaL_checkudata(L, index, META_BUFFER);
+			if (!wb->data) {
+				luaL_error(L,"buffer already moved");
+			}
+			data = wb->data;
+			*size = wb->size;
+			*buffer = wb;
+			break;
+		}
+		default:
+			luaL_error(L,"unkown type:%s",lua_typename(L,lua_type(L,index)));
+	}
+	return data;
+}
+
+static inline void
+message_moved(worker_buffer_t* buffer) {
+	if (buffer) {
+		buffer->data = NULL;
+		buffer->size = 0;
+	}
+}
+
+static inline void
+buffer_push(lua_State* L,void* data,size_t size) {
+	worker_buffer_t* wb = lua_newuserdata(L, sizeof(*wb));
+	wb->data = data;
+	wb->size = size;
+	luaL_setmetatable(L, META_BUFFER);
+}
 
+//接管serialize.pack返回的malloc内存,字符串拷一份
+static int
+lbuffer_new(lua_State* L) {
 	void* data = NULL;
 	size_t size = 0;
-
-	switch(lua_type(L,4)) {
+	switch(lua_type(L, 1)) {
 		case LUA_TSTRING: {
-			const char* str = lua_tolstring(L,4,&size);
+			const char* str = lua_tolstring(L, 1, &size);
 			data = malloc(size);
 			memcpy(data,str,size);
 			break;
 		}
-		case LUA_TUSERDATA:{
-			data = lua_touserdata(L,4);
-			size = lua_tointeger(L,5);
+		case LUA_TLIGHTUSERDATA: {
+			data = lua_touserdata(L, 1);
+			size = luaL_checkinteger(L, 2);
 			break;
 		}
 		default:
-			luaL_error(L,"unkown type:%s",lua_typename(L,lua_type(L,4)));
+			luaL_error(L,"unkown type:%s",lua_typename(L,lua_type(L,1)));
+	}
+	buffer_push(L, data, size);
+	return 1;
+}
+
+//channel回调里的数据指向session的输入缓冲,回调返回后就被回收,只能拷一份
+static int
+lbuffer_copy(lua_State* L) {
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	void* ptr = lua_touserdata(L, 1);
+	size_t size = luaL_checkinteger(L, 2);
+	void* data = malloc(size);
+	memcpy(data,ptr,size);
+	buffer_push(L, data, size);
+	return 1;
+}
+
+static int
+lbuffer_size(lua_State* L) {
+	worker_buffer_t* wb = luaL_checkudata(L, 1, META_BUFFER);
+	lua_pushinteger(L, wb->size);
+	return 1;
+}
+
+static int
+lbuffer_moved(lua_State* L) {
+	worker_buffer_t* wb = luaL_checkudata(L, 1, META_BUFFER);
+	lua_pushboolean(L, wb->data == NULL);
+	return 1;
+}
+
+static int
+lbuffer_gc(lua_State* L) {
+	worker_buffer_t* wb = luaL_checkudata(L, 1, META_BUFFER);
+	if (wb->data) {
+		free(wb->data);
+		wb->data = NULL;
+	}
+	return 0;
+}
+
+static void
+buffer_meta(lua_State* L) {
+	if (luaL_newmetatable(L, META_BUFFER)) {
+		const luaL_Reg meta_buffer[] = {
+			{ "size", lbuffer_size },
+			{ "moved", lbuffer_moved },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L,meta_buffer);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushcfunction(L, lbuffer_size);
+		lua_setfield(L, -2, "__len");
+
+		lua_pushcfunction(L, lbuffer_gc);
+		lua_setfield(L, -2, "__gc");
 	}
+	lua_pop(L, 1);
+}
+
+int
+module_push(lua_State* L) {
+	worker_ctx_t* ctx = lua_touserdata(L, 1);
+	int target = lua_tointeger(L,2);
+	int session = lua_tointeger(L,3);
+
+	size_t size = 0;
+	worker_buffer_t* buffer = NULL;
+	void* data = message_data(L, 4, &size, &buffer);
 
 	if (worker_push(target,ctx->id,session,data,size) < 0) {
+		if (lua_type(L, 4) == LUA_TSTRING) {
+			free(data);
+		}
 		lua_pushboolean(L,0);
 		return 1;
 	}
+	message_moved(buffer);
 	lua_pushboolean(L,1);
 	return 1;
 }
@@ -274,24 +384,10 @@ send_pipe(lua_State* L) {
 	worker_ctx_t* ctx = lua_touserdata(L, 1);
 	int session = lua_tointeger(L,2);
 
-	void* data = NULL;
 	size_t size = 0;
-
-	switch(lua_type(L,3)) {
-		case LUA_TSTRING: {
-			const char* str = lua_tolstring(L, 3, &size);
-			data = malloc(size);
-			memcpy(data,str,size);
-			break;
-		}
-		case LUA_TLIGHTUSERDATA:{
-			data = lua_touserdata(L, 3);
-			size = lua_tointeger(L, 4);
-			break;
-		}
-		default:
-			luaL_error(L,"unkown type:%s",lua_typename(L,lua_type(L,3)));
-	}
+	worker_buffer_t* buffer = NULL;
+	void* data = message_data(L, 3, &size, &buffer);
+	message_moved(buffer);
 
 	struct pipe_message* message = malloc(sizeof(*message));
 	message->next = NULL;
@@ -360,15 +456,12 @@ _worker(void* ud) {
 
 	worker_ctx_t* ctx = lua_newuserdata(L,sizeof(*ctx));
 	memset(ctx,0,sizeof(*ctx));
-	
-	mutex_init(&ctx->mutex);
-	cond_init(&ctx->cond);
 
 	ctx->id = -1;
 	ctx->quit = 0;
 	ctx->ref = 1;
 	ctx->queue = queue_create();
-	ctx->fd = args->fd;
+	ctx->channel = args->channel;
 
 	luaL_newmetatable(L,"meta_worker");
  	lua_setmetatable(L, -2);
@@ -395,11 +488,12 @@ int
 create(lua_State* L) {
 	pthread_once(&_MANAGER_INIT,&create_manager);
 
-	int fd = lua_tointeger(L, 1);
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	struct pipe_channel* channel = lua_touserdata(L, 1);
 	const char* startup_args = lua_tostring(L, 2);
 
 	struct startup_args* args = malloc(sizeof(*args));
-	args->fd = fd;
+	args->channel = channel;
 	args->args = strdup(startup_args);
 	sem_init(&args->sem, 0, -1);
 
@@ -424,30 +518,18 @@ main_push(lua_State* L) {
 	int target = lua_tointeger(L, 1);
 	int session = lua_tointeger(L, 2);
 
-	void* data = NULL;
 	size_t size = 0;
-
-	switch(lua_type(L,3)) {
-		case LUA_TSTRING: {
-			const char* str = lua_tolstring(L, 3, &size);
-			data = malloc(size);
-			memcpy(data,str,size);
-			break;
-		}
-		case LUA_TLIGHTUSERDATA:{
-			data = lua_touserdata(L, 3);
-			size = lua_tointeger(L, 4);
-			break;
-		}
-		default: {
-			luaL_error(L,"unkown type:%s",lua_typename(L,lua_type(L,3)));
-		}
-	}
+	worker_buffer_t* buffer = NULL;
+	void* data = message_data(L, 3, &size, &buffer);
 
 	if (worker_push(target,-1,session,data,size) < 0) {
+		if (lua_type(L, 3) == LUA_TSTRING) {
+			free(data);
+		}
 		lua_pushboolean(L,0);
 		return 1;
 	}
+	message_moved(buffer);
 	lua_pushboolean(L,1);
 	return 1;
 }
@@ -458,8 +540,11 @@ luaopen_worker_core(lua_State* L) {
 		{ "create", create },
 		{ "join", join },
 		{ "push", main_push },
+		{ "buffer", lbuffer_new },
+		{ "buffer_copy", lbuffer_copy },
 		{ NULL, NULL },
 	};
+	buffer_meta(L);
 	luaL_newlib(L, l);
 	return 1;
 }
\ No newline at end of file
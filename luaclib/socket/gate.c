@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <assert.h>
 #include <math.h>
+#include <stddef.h>
 
 #include "lua.h"
 #include "lualib.h"
@@ -13,21 +14,35 @@
 
 #include "socket/gate.h"
 #include "common/encrypt.h"
+#include "socket/gate_io.h"
+#include "lz4.h"
 
 #define CACHED_SIZE 		1024 * 1024
 #define WARN_OUTPUT_FLOW 	1024 * 10
 #define MAX_PACKET_SIZE		1024 * 6
 #define HEADER_SIZE			2
 #define ERROR_SIZE 			64
+#define PENDING_SIZE 		1024
+#define COMPRESS_FLAG 		0x8000
 
 #define SLOT(id,max) (id - (id / max) * max)
 
+#define CACHE_LINE 64
+#define CACHE_ALIGN(size) (((size) + CACHE_LINE - 1) & ~(CACHE_LINE - 1))
+
+typedef struct client_link {
+	struct client_link* prev;
+	struct client_link* next;
+} client_link_t;
+
 
 struct gate {
 	struct ev_loop_ctx* loop_ctx;
 	struct ev_listener* listener;
 
 	struct object_container* container;
+	uint8_t* slab;
+	size_t stride;
 	uint32_t max_client;
 	uint32_t count;
 	
@@ -35,8 +50,36 @@ struct gate {
 	uint32_t max_index;
 	uint32_t index;
 
+	//io线程模式下每个线程一个内部gate,id按线程数交错分配,外层gate只负责accept和转发
+	struct gate_io* io;
+	uint32_t shard;
+	uint32_t shard_count;
+
 	uint32_t max_freq;
 	uint32_t timeout;
+	uint32_t compress;
+
+	//令牌桶限流,rate为每秒补充的令牌数,burst为桶容量,cost为每个消息id消耗的令牌数,默认1
+	uint32_t rate;
+	uint32_t burst;
+	uint8_t* cost;
+	//毫秒时间从创建gate时算起,直接乘1000会超出uint32
+	double msec_base;
+
+	//按最后活跃的秒数分桶,每秒只检查刚好超时的那个桶
+	struct ev_timer sweeper;
+	client_link_t* bucket;
+	uint32_t bucket_size;
+	uint32_t second;
+
+	//聚合模式下一轮循环里发给同一个客户端的消息攒到一块连续的缓冲里,循环阻塞前统一写一次
+	int aggregate;
+	struct ev_prepare flusher;
+	client_link_t dirty;
+
+	//计数只在gate所在的线程里累加,accept_second是当前这一秒的accept数
+	struct gate_stats* stats;
+	uint64_t accept_second;
 
 	char error[ERROR_SIZE];
 
@@ -46,30 +89,106 @@ struct gate {
 	void* ud;
 };
 
+//收包状态机和get_client用到的字段排在前面,正好第一条cache line,聚合发送的字段放在第二条,session紧跟在后面
 typedef struct client {
-	gate_t* gate;
-	struct ev_session* session;
-	struct ev_timer timer;
 	uint32_t id;
-	uint32_t countor;
 	uint32_t need;
 	uint32_t freq;
+	uint32_t epoch;
 	uint16_t seed;
-	double tick;
-	int markdead;
-} client_t;
+	uint8_t markdead;
+	uint8_t reserve;
+	uint32_t countor;
+	uint32_t active;
+	struct ev_session* session;
+	gate_t* gate;
+	client_link_t link;
+
+	char* pending;
+	uint32_t pending_size;
+	uint32_t pending_cap;
+	client_link_t dirty;
+
+	//令牌数按千分之一计,refill是上次补充的毫秒时间
+	uint32_t tokens;
+	uint32_t refill;
+} __attribute__((aligned(CACHE_LINE))) client_t;
+
+static inline client_t*
+slab_client(gate_t* gate,uint32_t slot) {
+	return (client_t*)(gate->slab + gate->stride * slot);
+}
+
+static inline client_t*
+link_client(client_link_t* link) {
+	return (client_t*)((char*)link - offsetof(client_t, link));
+}
+
+static inline client_t*
+dirty_client(client_link_t* link) {
+	return (client_t*)((char*)link - offsetof(client_t, dirty));
+}
 
 __thread uint8_t CACHED_BUFFER[CACHED_SIZE];
+__thread LZ4_stream_t LZ4_STATE;
+
+static inline void
+link_init(client_link_t* link) {
+	link->prev = link->next = link;
+}
+
+static inline void
+link_remove(client_link_t* link) {
+	if (link->next == NULL) {
+		return;
+	}
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->prev = link->next = NULL;
+}
+
+static inline void
+link_push(client_link_t* head,client_link_t* link) {
+	link->prev = head->prev;
+	link->next = head;
+	head->prev->next = link;
+	head->prev = link;
+}
+
+static inline uint32_t
+gate_second(gate_t* gate) {
+	return (uint32_t)loop_ctx_now(gate->loop_ctx);
+}
+
+//客户端有消息时挂到当前秒的桶上,同一秒内重复活跃不用搬
+static inline void
+client_active(client_t* client) {
+	gate_t* gate = client->gate;
+	uint32_t now = gate->second;
+	if (client->link.next != NULL && client->active == now) {
+		return;
+	}
+	link_remove(&client->link);
+	client->active = now;
+	link_push(&gate->bucket[now % gate->bucket_size],&client->link);
+}
+
+static inline uint32_t
+client_slot(gate_t* gate,uint32_t id) {
+	return SLOT(id / gate->shard_count,gate->max_offset);
+}
 
 static void 
-close_client(int id,void* data) {
-	client_t* client = data;
-	ev_session_free(client->session);
-	ev_timer_stop(loop_ctx_get(client->gate->loop_ctx),(struct ev_timer*)&client->timer);
-	uint32_t slot = SLOT(client->id,client->gate->max_offset);
+close_client(client_t* client) {
+	link_remove(&client->dirty);
+	free(client->pending);
+	client->pending = NULL;
+	ev_session_fini(client->session);
+	link_remove(&client->link);
+	uint32_t slot = client_slot(client->gate,client->id);
 	container_remove(client->gate->container,slot);
 	client->gate->count--;
-	free(client);
+	client->id = 0;
 }
 
 static inline void
@@ -81,15 +200,18 @@ static inline void
 release_client(client_t* client) {
 	client->countor--;
 	if (client->countor == 0) {
-		close_client(0, client);
+		close_client(client);
 	}
 }
 
 static inline client_t*
 get_client(gate_t* gate,uint32_t id) {
-	uint32_t slot = SLOT(id,gate->max_offset);
-	client_t* client = container_get(gate->container,slot);
-	if (!client || client->id != id) {
+	uint32_t slot = client_slot(gate,id);
+	if (slot >= gate->max_client) {
+		return NULL;
+	}
+	client_t* client = slab_client(gate,slot);
+	if (client->id != id) {
 		return NULL;
 	}
 
@@ -115,18 +237,83 @@ free_buffer(uint8_t* buffer) {
     }
 }
 
+static inline struct gate_message_stats*
+message_stats(gate_t* gate,ushort message_id) {
+	if (message_id >= GATE_STATS_MESSAGE) {
+		return &gate->stats->message[GATE_STATS_MESSAGE];
+	}
+	return &gate->stats->message[message_id];
+}
+
+static inline void
+stats_output(gate_t* gate,ushort message_id,size_t size) {
+	struct gate_message_stats* message = message_stats(gate, message_id);
+	message->out_count++;
+	message->out_bytes += size;
+	gate->stats->messages_out++;
+	gate->stats->bytes_out += size;
+}
+
+static inline void
+stats_queue(gate_t* gate,size_t size) {
+	int index = 0;
+	size >>= 10;
+	while(size > 0 && index < GATE_STATS_OUTPUT - 1) {
+		size >>= 1;
+		index++;
+	}
+	gate->stats->output[index]++;
+}
+
 static void
-client_exit(client_t* client, const char* reason) {
+client_exit(client_t* client, int kick, const char* reason) {
+	client->gate->stats->kick[kick]++;
 	client->markdead = 1;
+	link_remove(&client->link);
 	gate_t* gate = client->gate;
 	gate->close(gate->ud, client->id, reason);
 	release_client(client);
 }
 
+static inline uint32_t
+gate_msec(gate_t* gate) {
+	double elapse = loop_ctx_now(gate->loop_ctx) - gate->msec_base;
+	if (elapse < 0) {
+		gate->msec_base = loop_ctx_now(gate->loop_ctx);
+		return 0;
+	}
+	return (uint32_t)(uint64_t)(elapse * 1000);
+}
+
+//按距上次补充的时间加令牌,够扣就扣掉返回0
+static inline int
+client_consume(client_t* client,uint16_t id) {
+	gate_t* gate = client->gate;
+	uint32_t now = gate_msec(gate);
+	uint32_t elapse = now - client->refill;
+	//时间往回拨了不补令牌,免得凭空多出一大桶
+	if ((int32_t)elapse < 0) {
+		elapse = 0;
+	}
+	uint64_t tokens = client->tokens + (uint64_t)elapse * gate->rate;
+	if (tokens > (uint64_t)gate->burst * 1000) {
+		tokens = (uint64_t)gate->burst * 1000;
+	}
+	client->refill = now;
+
+	uint32_t cost = (gate->cost ? gate->cost[id] : 1) * 1000;
+	if (tokens < cost) {
+		client->tokens = tokens;
+		return -1;
+	}
+	client->tokens = tokens - cost;
+	return 0;
+}
+
 static void
 client_error(struct ev_session* session,void* ud) {
 	client_t* client = ud;
-	client_exit(client, "client error");
+	client_exit(client, GATE_KICK_ERROR, "client error");
 }
 
 static int 
@@ -144,7 +331,7 @@ read_header(client_t* client) {
 
 	if (client->need > MAX_PACKET_SIZE) {
 		snprintf(client->gate->error, ERROR_SIZE, "client packet size:%d too much", client->need);
-		client_exit(client, client->gate->error);
+		client_exit(client, GATE_KICK_SIZE, client->gate->error);
 		return -1;
 	}
 	return 0;
@@ -163,14 +350,40 @@ read_body(client_t* client) {
 	
 	if (message_decrypt(&client->seed, data, client->need) < 0) {
 		free_buffer(data);
-	    client_exit(client, "client message decrypt error");
+	    client_exit(client, GATE_KICK_DECRYPT, "client message decrypt error");
 		return -1;
 	}
 
 	uint16_t id = data[2] | data[3] << 8;
 
-    client->freq++;
-    client->tick = loop_ctx_now(client->gate->loop_ctx);
+	//频率计数按gate的秒序号整体失效,不用逐个客户端清零
+	gate_t* gate = client->gate;
+	if (client->epoch != gate->second) {
+		client->epoch = gate->second;
+		client->freq = 0;
+	}
+	if (++client->freq > gate->max_freq) {
+		free_buffer(data);
+		snprintf(gate->error, ERROR_SIZE, "client receive message too much:%d in last 1s", client->freq);
+		client_exit(client, GATE_KICK_FREQ, gate->error);
+		return -1;
+	}
+	client_active(client);
+
+	//超出令牌桶的消息直接丢掉,不进上层分发
+	if (gate->rate > 0 && client_consume(client, id) < 0) {
+		gate->stats->drop++;
+		client->need = 0;
+		free_buffer(data);
+		return 0;
+	}
+
+	struct gate_message_stats* message = message_stats(gate, id);
+	message->in_count++;
+	message->in_bytes += client->need + HEADER_SIZE;
+	gate->stats->messages_in++;
+	gate->stats->bytes_in += client->need + HEADER_SIZE;
+
     client->gate->data(client->gate->ud,client->id,id,&data[4],client->need - 4);
     client->need = 0;
 
@@ -201,47 +414,174 @@ client_read(struct ev_session* ev_session, void* ud) {
 }	
 
 static void
-client_update(struct ev_loop* loop,struct ev_timer* io,int revents) {
+sweep_bucket(gate_t* gate,uint32_t second) {
+	client_link_t* bucket = &gate->bucket[second % gate->bucket_size];
+	if (bucket->next == bucket) {
+		return;
+	}
+	//先整串摘下来,回调里关掉的其他客户端会从这条临时链上摘走
+	client_link_t list;
+	list.next = bucket->next;
+	list.prev = bucket->prev;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	link_init(bucket);
+
+	while(list.next != &list) {
+		client_t* client = link_client(list.next);
+		link_remove(&client->link);
+		grab_client(client);
+		client_exit(client, GATE_KICK_TIMEOUT, "client timeout");
+		release_client(client);
+	}
+}
+
+static void
+gate_sweep(struct ev_loop* loop,struct ev_timer* io,int revents) {
 	assert(revents & EV_TIMER);
-	client_t* client = io->data;
-	grab_client(client);
+	gate_t* gate = io->data;
+	uint32_t now = gate_second(gate);
+	uint32_t elapse = now - gate->second;
+	if (elapse == 0) {
+		return;
+	}
+	//时间往回拨了,只重新对齐秒数,这一轮不扫
+	if ((int32_t)elapse < 0) {
+		gate->second = now;
+		gate->accept_second = 0;
+		return;
+	}
+	gate->stats->accept_rate = gate->accept_second / elapse;
+	gate->accept_second = 0;
+	//落后超过一圈时每个桶扫一遍就够了
+	if (elapse > gate->bucket_size) {
+		gate->second = now - gate->bucket_size;
+	}
+	while(gate->second != now) {
+		gate->second++;
+		//最后活跃在timeout+1秒之前的桶
+		sweep_bucket(gate,gate->second - gate->timeout - 1);
+	}
+}
 
-	if (ev_session_output_size(client->session) > WARN_OUTPUT_FLOW) {
-		fprintf(stderr,"client:%d more then %dkb flow need to send out\n",client->id,WARN_OUTPUT_FLOW/1024);
+//编码一帧最多需要的空间,超过压缩阈值时按lz4的上界预留
+static inline size_t
+frame_bound(gate_t* gate,size_t size) {
+	if (gate->compress > 0 && size > gate->compress) {
+		return sizeof(ushort) * 3 + LZ4_compressBound(size);
 	}
+	return sizeof(ushort) * 2 + size;
+}
 
-	if (client->freq > client->gate->max_freq) {
-		snprintf(client->gate->error, ERROR_SIZE, "client receive message too much:%d in last 1s", client->freq);
-		client_exit(client, client->gate->error);
-	} else {
-		client->freq = 0;
-		if (client->tick != 0 && loop_ctx_now(client->gate->loop_ctx) - client->tick > client->gate->timeout) {
-			client_exit(client, "client timeout");
+//帧格式: 2字节总长 + 2字节消息id + 数据
+//压缩过的帧消息id最高位置1,id后面多2字节原始长度,压缩后没变小就按原样发
+static size_t
+frame_encode(gate_t* gate,uint8_t* frame,ushort message_id,void* data,size_t size) {
+	ushort total;
+	if (gate->compress > 0 && size > gate->compress) {
+		int bound = LZ4_compressBound(size);
+		int compressed = LZ4_compress_fast_extState(&LZ4_STATE, data, (char*)frame + sizeof(ushort) * 3, size, bound, 1);
+		if (compressed > 0 && compressed + sizeof(ushort) < size) {
+			total = compressed + sizeof(ushort) * 3;
+			ushort id = message_id | COMPRESS_FLAG;
+			ushort raw = size;
+			memcpy(frame, &total, sizeof(ushort));
+			memcpy(frame + sizeof(ushort), &id, sizeof(ushort));
+			memcpy(frame + sizeof(ushort) * 2, &raw, sizeof(ushort));
+			return total;
 		}
 	}
+	total = size + sizeof(ushort) * 2;
+	memcpy(frame, &total, sizeof(ushort));
+	memcpy(frame + sizeof(ushort), &message_id, sizeof(ushort));
+	memcpy(frame + sizeof(ushort) * 2, data, size);
+	return total;
+}
+
+static int
+client_write(client_t* client,char* data,size_t size) {
+	size_t before = ev_session_output_size(client->session);
+	int ret = ev_session_write(client->session,data,size);
+	stats_queue(client->gate,ev_session_output_size(client->session));
+	if (ret >= 0 && before <= WARN_OUTPUT_FLOW && ev_session_output_size(client->session) > WARN_OUTPUT_FLOW) {
+		fprintf(stderr,"client:%d more then %dkb flow need to send out\n",client->id,WARN_OUTPUT_FLOW/1024);
+	}
+	return ret;
+}
+
+//把客户端攒着的帧整块交给session,之后的消息重新开一块缓冲
+static void
+client_flush(client_t* client) {
+	link_remove(&client->dirty);
+	if (client->pending == NULL) {
+		return;
+	}
+	char* pending = client->pending;
+	uint32_t size = client->pending_size;
+	client->pending = NULL;
+	client->pending_size = 0;
+	client->pending_cap = 0;
+
+	grab_client(client);
+	if (client_write(client,pending,size) < 0) {
+		free(pending);
+	}
 	release_client(client);
 }
 
-static void 
-client_accept(struct ev_listener *listener, int fd, const char* addr, void *ud) {
-	gate_t* gate = ud;
+static void
+gate_flush(struct ev_loop* loop,struct ev_prepare* io,int revents) {
+	gate_t* gate = io->data;
+	while(gate->dirty.next != &gate->dirty) {
+		client_flush(dirty_client(gate->dirty.next));
+	}
+	ev_prepare_stop(loop,io);
+}
+
+//在客户端的聚合缓冲后面预留size字节,第一次写入时挂到gate的dirty链表上
+static uint8_t*
+client_reserve(client_t* client,size_t size) {
+	gate_t* gate = client->gate;
+	if (client->pending_size + size > client->pending_cap) {
+		uint32_t cap = client->pending_cap ? client->pending_cap : PENDING_SIZE;
+		while(cap < client->pending_size + size) {
+			cap *= 2;
+		}
+		client->pending = realloc(client->pending,cap);
+		client->pending_cap = cap;
+	}
+	uint8_t* ptr = (uint8_t*)client->pending + client->pending_size;
+	client->pending_size += size;
+
+	if (client->dirty.next == NULL) {
+		link_push(&gate->dirty,&client->dirty);
+		if (!ev_is_active(&gate->flusher)) {
+			ev_prepare_start(loop_ctx_get(gate->loop_ctx),&gate->flusher);
+		}
+	}
+	return ptr;
+}
 
+void
+gate_attach(gate_t* gate,int fd,const char* addr) {
 	if (gate->count >= gate->max_client) {
+		gate->stats->reject++;
 		close(fd);
 		return;
 	}
+	gate->stats->accept++;
+	gate->accept_second++;
 
 	gate->count++;
 
-	socket_nonblock(fd);
-	socket_keep_alive(fd);
-	socket_closeonexec(fd);
+	//容器只负责分配槽位,客户端和session都放在slab对应的位置上
+	int slot = container_add(gate->container, NULL);
+	assert(slot < gate->max_client);
 
-	client_t* client = malloc(sizeof(*client));
+	client_t* client = slab_client(gate, slot);
 	memset(client, 0, sizeof(*client));
 
-	struct ev_session* session = ev_session_bind(gate->loop_ctx, fd);
-	int slot = container_add(gate->container, client);
+	struct ev_session* session = ev_session_init((uint8_t*)client + CACHE_ALIGN(sizeof(client_t)), gate->loop_ctx, fd);
 	
 	uint32_t index = gate->index++;
 	if (index >= gate->max_index)
@@ -249,20 +589,44 @@ client_accept(struct ev_listener *listener, int fd, const char* addr, void *ud)
 
 	client->gate = gate;
 	client->session = session;
-	client->id = index * gate->max_offset + slot;
+	client->tokens = gate->burst * 1000;
+	client->refill = gate_msec(gate);
+	client->id = (index * gate->max_offset + slot) * gate->shard_count + gate->shard;
 
 	grab_client(client);
 
 	ev_session_setcb(client->session, client_read, NULL, client_error, client);
 	ev_session_enable(client->session, EV_READ);
 
-	client->timer.data = client;
-	ev_timer_init(&client->timer, client_update, 1, 1);
-	ev_timer_start(loop_ctx_get(gate->loop_ctx), &client->timer);
-
 	gate->accept(gate->ud, client->id, addr);
 }
 
+static void 
+client_accept(struct ev_listener *listener, int fd, const char* addr, void *ud) {
+	gate_t* gate = ud;
+	if (gate->io) {
+		gate_io_attach(gate->io, fd, addr);
+		return;
+	}
+	gate_attach(gate, fd, addr);
+}
+
+static void
+io_dispatch(void* ud,int type,uint32_t client_id,int message_id,void* data,size_t size) {
+	gate_t* gate = ud;
+	switch(type) {
+		case GATE_IO_ACCEPT:
+			gate->accept(gate->ud, client_id, data);
+			break;
+		case GATE_IO_CLOSE:
+			gate->close(gate->ud, client_id, data);
+			break;
+		case GATE_IO_DATA:
+			gate->data(gate->ud, client_id, message_id, data, size);
+			break;
+	}
+}
+
 static void
 close_complete(struct ev_session* ev_session, void* ud) {
 	client_t* client = ud;
@@ -277,7 +641,7 @@ close_error(struct ev_session* session, void* ud) {
 }
 
 gate_t*
-gate_create(struct ev_loop_ctx* loop_ctx,uint32_t max_client, uint32_t max_freq, uint32_t timeout,void* ud) {
+gate_create(struct ev_loop_ctx* loop_ctx,uint32_t max_client, uint32_t max_freq, uint32_t timeout,uint32_t compress,void* ud) {
 	if (max_client < 1 || max_freq < 1 || timeout < 1) {
 		return NULL;
 	}
@@ -286,10 +650,20 @@ gate_create(struct ev_loop_ctx* loop_ctx,uint32_t max_client, uint32_t max_freq,
 	memset(gate, 0, sizeof(*gate));
 
 	gate->container = container_create(max_client);
+	gate->stride = CACHE_ALIGN(sizeof(client_t)) + CACHE_ALIGN(ev_session_size());
+	if (posix_memalign((void**)&gate->slab, CACHE_LINE, gate->stride * max_client) != 0) {
+		container_release(gate->container);
+		free(gate);
+		return NULL;
+	}
+	memset(gate->slab, 0, gate->stride * max_client);
+	gate->stats = malloc(sizeof(struct gate_stats));
+	memset(gate->stats, 0, sizeof(struct gate_stats));
 	gate->loop_ctx = loop_ctx;
 	gate->ud = ud;
 	gate->max_freq = max_freq;
 	gate->timeout = timeout;
+	gate->compress = compress;
 
 	gate->count = 0;
 	gate->max_client = max_client;
@@ -302,9 +676,59 @@ gate_create(struct ev_loop_ctx* loop_ctx,uint32_t max_client, uint32_t max_freq,
 
 	gate->index = 1;
 	gate->max_index = 0xffffffff / gate->max_offset;
+	gate->shard = 0;
+	gate->shard_count = 1;
+
+	link_init(&gate->dirty);
+	gate->flusher.data = gate;
+	ev_prepare_init(&gate->flusher, gate_flush);
+
+	gate->bucket_size = timeout + 2;
+	gate->bucket = malloc(sizeof(client_link_t) * gate->bucket_size);
+	uint32_t i;
+	for(i = 0;i < gate->bucket_size;i++) {
+		link_init(&gate->bucket[i]);
+	}
+	gate->second = gate_second(gate);
+	gate->msec_base = loop_ctx_now(loop_ctx);
+	gate->sweeper.data = gate;
+	ev_timer_init(&gate->sweeper, gate_sweep, 1, 1);
+	ev_timer_start(loop_ctx_get(loop_ctx), &gate->sweeper);
+	return gate;
+}
+
+//外层gate不持有客户端,只有监听和io线程
+gate_t*
+gate_create_threaded(struct ev_loop_ctx* loop_ctx,uint32_t max_client, uint32_t max_freq, uint32_t timeout,uint32_t compress,uint32_t threads,void* ud) {
+	if (max_client < 1 || max_freq < 1 || timeout < 1 || threads < 1) {
+		return NULL;
+	}
+
+	gate_t* gate = malloc(sizeof(*gate));
+	memset(gate, 0, sizeof(*gate));
+	gate->loop_ctx = loop_ctx;
+	gate->ud = ud;
+	gate->max_client = max_client;
+	gate->max_freq = max_freq;
+	gate->timeout = timeout;
+	gate->compress = compress;
+	gate->shard_count = 1;
+
+	gate->io = gate_io_create(loop_ctx, threads, (max_client + threads - 1) / threads, max_freq, timeout, compress, io_dispatch, gate);
+	if (!gate->io) {
+		free(gate);
+		return NULL;
+	}
 	return gate;
 }
 
+void
+gate_shard(gate_t* gate,uint32_t shard,uint32_t count) {
+	gate->shard = shard;
+	gate->shard_count = count;
+	gate->max_index = 0xffffffff / gate->max_offset / count;
+}
+
 int
 gate_start(gate_t* gate,const char* ip,int port) {
 	struct sockaddr_in si;
@@ -313,7 +737,7 @@ gate_start(gate_t* gate,const char* ip,int port) {
 	si.sin_port = htons(port);
 
 	int flag = SOCKET_OPT_NOBLOCK | SOCKET_OPT_CLOSE_ON_EXEC | SOCKET_OPT_REUSEABLE_ADDR;
-	gate->listener = ev_listener_bind(gate->loop_ctx,(struct sockaddr*)&si,sizeof(si),16,flag,client_accept,gate);
+	gate->listener = ev_listener_bind(gate->loop_ctx,(struct sockaddr*)&si,sizeof(si),LISTEN_BACKLOG,flag,client_accept,gate);
 	if (!gate->listener) {
 		return -1;
 	}
@@ -347,17 +771,23 @@ gate_stop(gate_t* gate) {
 
 int
 gate_close(gate_t* gate,uint32_t client_id,int grace) {
+	if (gate->io) {
+		return gate_io_close(gate->io, client_id, grace);
+	}
 	client_t* client = get_client(gate,client_id);
 	if (!client) {
 		return -1;
 	}
 	grab_client(client);
+	gate->stats->kick[GATE_KICK_CLOSE]++;
 
 	if (!grace) {
 		release_client(client);
 	}
 	else {
+		client_flush(client);
 		client->markdead = 1;
+		link_remove(&client->link);
 		ev_session_setcb(client->session, NULL, close_complete, close_error, client);
 		ev_session_enable(client->session, EV_WRITE);
 		ev_session_disable(client->session, EV_READ);
@@ -368,20 +798,37 @@ gate_close(gate_t* gate,uint32_t client_id,int grace) {
 
 int
 gate_send(gate_t* gate,uint32_t client_id,ushort message_id,void* data,size_t size) {
+	//开了压缩的gate最高位留给压缩标记
+	if (gate->compress > 0 && (message_id & COMPRESS_FLAG)) {
+		return -1;
+	}
+	if (gate->io) {
+		return gate_io_send(gate->io, client_id, message_id, data, size);
+	}
 	client_t* client = get_client(gate,client_id);
 	if (!client) {
 		return -1;
 	}
 	grab_client(client);
 
-	ushort total = size + sizeof(short) * 2;
+	size_t bound = frame_bound(gate, size);
 
-    uint8_t* mb = malloc(total);
-    memcpy(mb, &total, sizeof(ushort));
-    memcpy(mb + sizeof(ushort), &message_id, sizeof(ushort));
-    memcpy(mb + sizeof(ushort) * 2, data, size);
+	if (gate->aggregate) {
+		uint8_t* mb = client_reserve(client, bound);
+		size_t total = frame_encode(gate, mb, message_id, data, size);
+		client->pending_size -= bound - total;
+		stats_output(gate, message_id, total);
+		release_client(client);
+		return 0;
+	}
 
-    int ret = ev_session_write(client->session,(char*)mb,total);
+    uint8_t* mb = malloc(bound);
+    size_t total = frame_encode(gate, mb, message_id, data, size);
+
+    int ret = client_write(client,(char*)mb,total);
+    if (ret >= 0) {
+    	stats_output(gate, message_id, total);
+    }
     release_client(client);
 	if (ret < 0) {
 		free(mb);
@@ -390,10 +837,136 @@ gate_send(gate_t* gate,uint32_t client_id,ushort message_id,void* data,size_t si
 	return 0;
 }
 
+//帧只构造一次,所有客户端的输出队列引用同一块缓冲,返回实际发出的客户端数
+int
+gate_multicast(gate_t* gate,uint32_t* ids,int count,ushort message_id,void* data,size_t size) {
+	//开了压缩的gate最高位留给压缩标记
+	if (gate->compress > 0 && (message_id & COMPRESS_FLAG)) {
+		return -1;
+	}
+	if (gate->io) {
+		return gate_io_multicast(gate->io, ids, count, message_id, data, size);
+	}
+
+	struct ev_shared* shared = ev_shared_create(frame_bound(gate, size));
+	shared->size = frame_encode(gate, (uint8_t*)shared->data, message_id, data, size);
+	size_t total = shared->size;
+
+	int sent = 0;
+	int i;
+	for(i = 0;i < count;i++) {
+		client_t* client = get_client(gate,ids[i]);
+		if (!client) {
+			continue;
+		}
+		grab_client(client);
+		if (gate->aggregate) {
+			memcpy(client_reserve(client, total), shared->data, total);
+			stats_output(gate, message_id, total);
+			sent++;
+		} else if (ev_session_write_shared(client->session,shared) >= 0) {
+			stats_queue(gate, ev_session_output_size(client->session));
+			stats_output(gate, message_id, total);
+			sent++;
+		}
+		release_client(client);
+	}
+	ev_shared_release(shared);
+	return sent;
+}
+
+void
+gate_aggregate(gate_t* gate,int on) {
+	if (gate->io) {
+		gate_io_aggregate(gate->io, on);
+		return;
+	}
+	gate->aggregate = on;
+	if (!on) {
+		gate_flush(loop_ctx_get(gate->loop_ctx), &gate->flusher, EV_PREPARE);
+	}
+}
+
+//累加到stats上,io线程模式下把各线程内部gate的计数加在一起,读的时候不加锁,只是近似值
+void
+gate_stats(gate_t* gate,struct gate_stats* stats) {
+	if (gate->io) {
+		gate_io_stats(gate->io, stats);
+		return;
+	}
+	struct gate_stats* from = gate->stats;
+	stats->bytes_in += from->bytes_in;
+	stats->bytes_out += from->bytes_out;
+	stats->messages_in += from->messages_in;
+	stats->messages_out += from->messages_out;
+	stats->accept += from->accept;
+	stats->reject += from->reject;
+	stats->accept_rate += from->accept_rate;
+	stats->drop += from->drop;
+
+	int i;
+	for(i = 0;i < GATE_KICK_MAX;i++) {
+		stats->kick[i] += from->kick[i];
+	}
+	for(i = 0;i < GATE_STATS_OUTPUT;i++) {
+		stats->output[i] += from->output[i];
+	}
+	for(i = 0;i <= GATE_STATS_MESSAGE;i++) {
+		if (from->message[i].in_count == 0 && from->message[i].out_count == 0) {
+			continue;
+		}
+		stats->message[i].in_count += from->message[i].in_count;
+		stats->message[i].in_bytes += from->message[i].in_bytes;
+		stats->message[i].out_count += from->message[i].out_count;
+		stats->message[i].out_bytes += from->message[i].out_bytes;
+	}
+}
+
+//rate为0关闭限流
+void
+gate_limit(gate_t* gate,uint32_t rate,uint32_t burst) {
+	if (gate->io) {
+		gate_io_limit(gate->io, rate, burst);
+		return;
+	}
+	gate->rate = rate;
+	gate->burst = burst;
+}
+
+void
+gate_cost(gate_t* gate,ushort message_id,uint8_t cost) {
+	if (gate->io) {
+		gate_io_cost(gate->io, message_id, cost);
+		return;
+	}
+	if (gate->cost == NULL) {
+		gate->cost = malloc(0x10000);
+		memset(gate->cost, 1, 0x10000);
+	}
+	gate->cost[message_id] = cost;
+}
+
 void
 gate_release(gate_t* gate) {
 	gate_stop(gate);
-	container_foreach(gate->container,close_client);
+	if (gate->io) {
+		gate_io_release(gate->io);
+		free(gate);
+		return;
+	}
+	ev_timer_stop(loop_ctx_get(gate->loop_ctx), &gate->sweeper);
+	ev_prepare_stop(loop_ctx_get(gate->loop_ctx), &gate->flusher);
+	uint32_t i;
+	for(i = 0;i < gate->max_client;i++) {
+		client_t* client = slab_client(gate,i);
+		if (client->id != 0) {
+			close_client(client);
+		}
+	}
 	container_release(gate->container);
+	free(gate->cost);
+	free(gate->stats);
+	free(gate->slab);
+	free(gate->bucket);
 	free(gate);
 }
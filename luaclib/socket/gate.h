@@ -9,19 +9,61 @@
 
 typedef struct gate gate_t;
 
+#define GATE_KICK_ERROR 	0
+#define GATE_KICK_SIZE 		1
+#define GATE_KICK_DECRYPT 	2
+#define GATE_KICK_FREQ 		3
+#define GATE_KICK_TIMEOUT 	4
+#define GATE_KICK_CLOSE 	5
+#define GATE_KICK_MAX 		6
+
+//消息id小于GATE_STATS_MESSAGE的单独统计,其余的都算在最后一格
+#define GATE_STATS_MESSAGE 	4096
+//输出队列长度按1kb起的2的幂分段
+#define GATE_STATS_OUTPUT 	16
+
+struct gate_message_stats {
+	uint64_t in_count;
+	uint64_t in_bytes;
+	uint64_t out_count;
+	uint64_t out_bytes;
+};
+
+struct gate_stats {
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t messages_in;
+	uint64_t messages_out;
+	uint64_t accept;
+	uint64_t reject;
+	uint64_t accept_rate;
+	uint64_t drop;
+	uint64_t kick[GATE_KICK_MAX];
+	uint64_t output[GATE_STATS_OUTPUT];
+	struct gate_message_stats message[GATE_STATS_MESSAGE + 1];
+};
+
 typedef void (*accept_callback)(void* ud,uint32_t client_id,const char* addr);
 typedef void (*close_callback)(void* ud,uint32_t client_id,const char* reason);
 typedef void (*data_callback)(void* ud,uint32_t client_id,int message_id,void* data,size_t size);
 
-gate_t* gate_create(struct ev_loop_ctx* loop_ctx,uint32_t max_client, uint32_t max_freq, uint32_t timeout,void* ud);
+gate_t* gate_create(struct ev_loop_ctx* loop_ctx,uint32_t max_client, uint32_t max_freq, uint32_t timeout,uint32_t compress,void* ud);
+gate_t* gate_create_threaded(struct ev_loop_ctx* loop_ctx,uint32_t max_client, uint32_t max_freq, uint32_t timeout,uint32_t compress,uint32_t threads,void* ud);
+void gate_shard(gate_t* gate,uint32_t shard,uint32_t count);
+void gate_attach(gate_t* gate,int fd,const char* addr);
+void gate_aggregate(gate_t* gate,int on);
+void gate_limit(gate_t* gate,uint32_t rate,uint32_t burst);
+void gate_cost(gate_t* gate,ushort message_id,uint8_t cost);
 void gate_release(gate_t* gate);
 int gate_start(gate_t* gate,const char* ip,int port);
 int gate_stop(gate_t* gate);
 
 int gate_send(gate_t* gate,uint32_t client_id,ushort message_id,void* data,size_t size);
+int gate_multicast(gate_t* gate,uint32_t* ids,int count,ushort message_id,void* data,size_t size);
 int gate_close(gate_t* gate,uint32_t client_id,int grace);
 
 void gate_callback(gate_t* gate,accept_callback accept,close_callback close,data_callback data);
+void gate_stats(gate_t* gate,struct gate_stats* stats);
 
 
 
@@ -0,0 +1,427 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "socket/gate.h"
+#include "socket/gate_io.h"
+#include "common/spsc_queue.h"
+
+#define QUEUE_SIZE 	4096
+#define RETRY_TIME 	0.001
+
+#define IO_CMD_ATTACH 		1
+#define IO_CMD_SEND 		2
+#define IO_CMD_MULTICAST 	3
+#define IO_CMD_CLOSE 		4
+#define IO_CMD_STOP 		5
+#define IO_CMD_AGGREGATE 	6
+#define IO_CMD_LIMIT 		7
+#define IO_CMD_COST 		8
+
+//io线程和主线程之间传递的记录,线程间通过spsc队列交接,谁取出来谁释放
+typedef struct io_record {
+	struct io_record* next;
+	int type;
+	uint32_t client_id;
+	int message_id;
+	int arg;
+	size_t size;
+	char data[0];
+} io_record_t;
+
+//队列满的时候先挂在生产者本地的溢出链表上,用定时器重试,不阻塞生产者的循环
+typedef struct io_channel {
+	struct spsc_queue* queue;
+	io_record_t* first;
+	io_record_t* last;
+	struct ev_timer retry;
+	struct ev_loop* producer;
+	struct ev_loop* consumer;
+	struct ev_async* doorbell;
+} io_channel_t;
+
+typedef struct io_thread {
+	struct gate_io* io;
+	uint32_t index;
+	pthread_t pid;
+	struct ev_loop_ctx* loop_ctx;
+	gate_t* gate;
+	struct ev_async notify;
+	io_channel_t inbound;
+	io_channel_t outbound;
+} io_thread_t;
+
+struct gate_io {
+	struct ev_loop_ctx* loop_ctx;
+	struct ev_async notify;
+	io_thread_t* thread;
+	uint32_t count;
+	uint32_t cursor;
+	gate_io_dispatch dispatch;
+	void* ud;
+};
+
+static inline io_record_t*
+record_create(int type,uint32_t client_id,int message_id,const void* data,size_t size) {
+	io_record_t* record = malloc(sizeof(*record) + size);
+	record->next = NULL;
+	record->type = type;
+	record->client_id = client_id;
+	record->message_id = message_id;
+	record->arg = 0;
+	record->size = size;
+	if (size > 0 && data) {
+		memcpy(record->data, data, size);
+	}
+	return record;
+}
+
+static inline void
+record_free(io_record_t* record) {
+	if (record->type == IO_CMD_ATTACH) {
+		close(record->arg);
+	}
+	free(record);
+}
+
+static void
+_channel_retry(struct ev_loop* loop,struct ev_timer* io,int revents) {
+	io_channel_t* channel = io->data;
+	while(channel->first) {
+		if (spsc_queue_push(channel->queue, channel->first) < 0) {
+			break;
+		}
+		channel->first = channel->first->next;
+	}
+	if (channel->first == NULL) {
+		channel->last = NULL;
+		ev_timer_stop(loop, io);
+	}
+	ev_async_send(channel->consumer, channel->doorbell);
+}
+
+static void
+channel_init(io_channel_t* channel,struct ev_loop* producer,struct ev_loop* consumer,struct ev_async* doorbell) {
+	memset(channel, 0, sizeof(*channel));
+	channel->queue = spsc_queue_create(QUEUE_SIZE);
+	channel->producer = producer;
+	channel->consumer = consumer;
+	channel->doorbell = doorbell;
+	channel->retry.data = channel;
+	ev_timer_init(&channel->retry, _channel_retry, RETRY_TIME, RETRY_TIME);
+}
+
+//只在所有线程都退出之后调用,把没送达的记录丢掉
+static void
+channel_release(io_channel_t* channel) {
+	io_record_t* record;
+	while((record = spsc_queue_pop(channel->queue)) != NULL) {
+		record_free(record);
+	}
+	while(channel->first) {
+		record = channel->first;
+		channel->first = record->next;
+		record_free(record);
+	}
+	spsc_queue_release(channel->queue);
+}
+
+static void
+channel_push(io_channel_t* channel,io_record_t* record) {
+	if (channel->first == NULL && spsc_queue_push(channel->queue, record) == 0) {
+		ev_async_send(channel->consumer, channel->doorbell);
+		return;
+	}
+	if (channel->last) {
+		channel->last->next = record;
+	} else {
+		channel->first = record;
+	}
+	channel->last = record;
+	if (!ev_is_active(&channel->retry)) {
+		ev_timer_start(channel->producer, &channel->retry);
+	}
+}
+
+//-------------------------io线程里的内部gate回调---------------------------
+static void
+thread_accept(void* ud,uint32_t client_id,const char* addr) {
+	io_thread_t* thread = ud;
+	channel_push(&thread->inbound, record_create(GATE_IO_ACCEPT, client_id, 0, addr, strlen(addr) + 1));
+}
+
+static void
+thread_close(void* ud,uint32_t client_id,const char* reason) {
+	io_thread_t* thread = ud;
+	channel_push(&thread->inbound, record_create(GATE_IO_CLOSE, client_id, 0, reason, strlen(reason) + 1));
+}
+
+static void
+thread_data(void* ud,uint32_t client_id,int message_id,void* data,size_t size) {
+	io_thread_t* thread = ud;
+	channel_push(&thread->inbound, record_create(GATE_IO_DATA, client_id, message_id, data, size));
+}
+
+static void
+_thread_notify(struct ev_loop* loop,struct ev_async* io,int revents) {
+	io_thread_t* thread = io->data;
+	io_record_t* record;
+	while((record = spsc_queue_pop(thread->outbound.queue)) != NULL) {
+		switch(record->type) {
+			case IO_CMD_ATTACH: {
+				gate_attach(thread->gate, record->arg, record->data);
+				break;
+			}
+			case IO_CMD_SEND: {
+				gate_send(thread->gate, record->client_id, record->message_id, record->data, record->size);
+				break;
+			}
+			case IO_CMD_MULTICAST: {
+				uint32_t* ids = (uint32_t*)record->data;
+				size_t offset = sizeof(uint32_t) * record->arg;
+				gate_multicast(thread->gate, ids, record->arg, record->message_id, record->data + offset, record->size - offset);
+				break;
+			}
+			case IO_CMD_CLOSE: {
+				gate_close(thread->gate, record->client_id, record->arg);
+				break;
+			}
+			case IO_CMD_AGGREGATE: {
+				gate_aggregate(thread->gate, record->arg);
+				break;
+			}
+			case IO_CMD_LIMIT: {
+				gate_limit(thread->gate, record->client_id, record->arg);
+				break;
+			}
+			case IO_CMD_COST: {
+				gate_cost(thread->gate, record->message_id, record->arg);
+				break;
+			}
+			case IO_CMD_STOP: {
+				loop_ctx_break(thread->loop_ctx);
+				break;
+			}
+		}
+		free(record);
+	}
+}
+
+static void*
+thread_main(void* ud) {
+	io_thread_t* thread = ud;
+	loop_ctx_dispatch(thread->loop_ctx);
+	return NULL;
+}
+
+//-------------------------主线程---------------------------
+//一次把所有io线程攒下的记录取完,逐条回调给上层
+static void
+_io_notify(struct ev_loop* loop,struct ev_async* io,int revents) {
+	struct gate_io* gio = io->data;
+	uint32_t i;
+	for(i = 0;i < gio->count;i++) {
+		io_thread_t* thread = &gio->thread[i];
+		io_record_t* record;
+		while((record = spsc_queue_pop(thread->inbound.queue)) != NULL) {
+			gio->dispatch(gio->ud, record->type, record->client_id, record->message_id, record->data, record->size);
+			free(record);
+		}
+	}
+}
+
+struct gate_io*
+gate_io_create(struct ev_loop_ctx* loop_ctx,uint32_t threads,uint32_t max_client,uint32_t max_freq,uint32_t timeout,uint32_t compress,gate_io_dispatch dispatch,void* ud) {
+	struct gate_io* gio = malloc(sizeof(*gio));
+	memset(gio, 0, sizeof(*gio));
+	gio->loop_ctx = loop_ctx;
+	gio->count = threads;
+	gio->dispatch = dispatch;
+	gio->ud = ud;
+
+	gio->notify.data = gio;
+	ev_async_init(&gio->notify, _io_notify);
+	ev_async_start(loop_ctx_get(loop_ctx), &gio->notify);
+
+	gio->thread = malloc(sizeof(io_thread_t) * threads);
+	memset(gio->thread, 0, sizeof(io_thread_t) * threads);
+
+	uint32_t i;
+	for(i = 0;i < threads;i++) {
+		io_thread_t* thread = &gio->thread[i];
+		thread->io = gio;
+		thread->index = i;
+		thread->loop_ctx = loop_ctx_create();
+
+		struct ev_loop* main_loop = loop_ctx_get(loop_ctx);
+		struct ev_loop* thread_loop = loop_ctx_get(thread->loop_ctx);
+
+		thread->gate = gate_create(thread->loop_ctx, max_client, max_freq, timeout, compress, thread);
+		if (!thread->gate) {
+			//线程还没启动,把已经建好的循环和队列拆掉
+			loop_ctx_release(thread->loop_ctx);
+			while(i-- > 0) {
+				thread = &gio->thread[i];
+				gate_release(thread->gate);
+				channel_release(&thread->inbound);
+				channel_release(&thread->outbound);
+				ev_timer_stop(main_loop, &thread->outbound.retry);
+				loop_ctx_release(thread->loop_ctx);
+			}
+			ev_async_stop(main_loop, &gio->notify);
+			free(gio->thread);
+			free(gio);
+			return NULL;
+		}
+		gate_shard(thread->gate, i, threads);
+		gate_callback(thread->gate, thread_accept, thread_close, thread_data);
+
+		thread->notify.data = thread;
+		ev_async_init(&thread->notify, _thread_notify);
+		ev_async_start(thread_loop, &thread->notify);
+
+		channel_init(&thread->inbound, thread_loop, main_loop, &gio->notify);
+		channel_init(&thread->outbound, main_loop, thread_loop, &thread->notify);
+	}
+
+	for(i = 0;i < threads;i++) {
+		io_thread_t* thread = &gio->thread[i];
+		if (pthread_create(&thread->pid, NULL, thread_main, thread)) {
+			fprintf(stderr, "gate io thread create failed\n");
+			exit(1);
+		}
+	}
+	return gio;
+}
+
+void
+gate_io_release(struct gate_io* gio) {
+	uint32_t i;
+	for(i = 0;i < gio->count;i++) {
+		io_thread_t* thread = &gio->thread[i];
+		channel_push(&thread->outbound, record_create(IO_CMD_STOP, 0, 0, NULL, 0));
+	}
+
+	struct ev_loop* main_loop = loop_ctx_get(gio->loop_ctx);
+	for(i = 0;i < gio->count;i++) {
+		io_thread_t* thread = &gio->thread[i];
+		//STOP可能还挂在溢出链表上,在这里推进队列
+		while(thread->outbound.first) {
+			_channel_retry(main_loop, &thread->outbound.retry, EV_TIMER);
+			if (thread->outbound.first) {
+				usleep(1000);
+			}
+		}
+		pthread_join(thread->pid, NULL);
+	}
+
+	ev_async_stop(main_loop, &gio->notify);
+	for(i = 0;i < gio->count;i++) {
+		io_thread_t* thread = &gio->thread[i];
+		gate_release(thread->gate);
+		channel_release(&thread->inbound);
+		channel_release(&thread->outbound);
+		ev_timer_stop(main_loop, &thread->outbound.retry);
+		loop_ctx_release(thread->loop_ctx);
+	}
+	free(gio->thread);
+	free(gio);
+}
+
+void
+gate_io_attach(struct gate_io* gio,int fd,const char* addr) {
+	io_thread_t* thread = &gio->thread[gio->cursor++ % gio->count];
+	io_record_t* record = record_create(IO_CMD_ATTACH, 0, 0, addr, strlen(addr) + 1);
+	record->arg = fd;
+	channel_push(&thread->outbound, record);
+}
+
+//客户端在io线程里,这里只能确认id属于哪个线程,客户端已经断开的消息由io线程丢弃
+int
+gate_io_send(struct gate_io* gio,uint32_t client_id,uint16_t message_id,void* data,size_t size) {
+	io_thread_t* thread = &gio->thread[client_id % gio->count];
+	channel_push(&thread->outbound, record_create(IO_CMD_SEND, client_id, message_id, data, size));
+	return 0;
+}
+
+int
+gate_io_multicast(struct gate_io* gio,uint32_t* ids,int count,uint16_t message_id,void* data,size_t size) {
+	uint32_t* total = malloc(sizeof(uint32_t) * gio->count);
+	memset(total, 0, sizeof(uint32_t) * gio->count);
+
+	int i;
+	for(i = 0;i < count;i++) {
+		total[ids[i] % gio->count]++;
+	}
+
+	uint32_t t;
+	for(t = 0;t < gio->count;t++) {
+		if (total[t] == 0) {
+			continue;
+		}
+		size_t offset = sizeof(uint32_t) * total[t];
+		io_record_t* record = record_create(IO_CMD_MULTICAST, 0, message_id, NULL, offset + size);
+		record->arg = total[t];
+		uint32_t* slot = (uint32_t*)record->data;
+		int n = 0;
+		for(i = 0;i < count;i++) {
+			if (ids[i] % gio->count == t) {
+				slot[n++] = ids[i];
+			}
+		}
+		memcpy(record->data + offset, data, size);
+		channel_push(&gio->thread[t].outbound, record);
+	}
+	free(total);
+	return count;
+}
+
+int
+gate_io_close(struct gate_io* gio,uint32_t client_id,int grace) {
+	io_thread_t* thread = &gio->thread[client_id % gio->count];
+	io_record_t* record = record_create(IO_CMD_CLOSE, client_id, 0, NULL, 0);
+	record->arg = grace;
+	channel_push(&thread->outbound, record);
+	return 0;
+}
+
+void
+gate_io_aggregate(struct gate_io* gio,int on) {
+	uint32_t i;
+	for(i = 0;i < gio->count;i++) {
+		io_record_t* record = record_create(IO_CMD_AGGREGATE, 0, 0, NULL, 0);
+		record->arg = on;
+		channel_push(&gio->thread[i].outbound, record);
+	}
+}
+
+void
+gate_io_limit(struct gate_io* gio,uint32_t rate,uint32_t burst) {
+	uint32_t i;
+	for(i = 0;i < gio->count;i++) {
+		io_record_t* record = record_create(IO_CMD_LIMIT, rate, 0, NULL, 0);
+		record->arg = burst;
+		channel_push(&gio->thread[i].outbound, record);
+	}
+}
+
+void
+gate_io_cost(struct gate_io* gio,uint16_t message_id,uint8_t cost) {
+	uint32_t i;
+	for(i = 0;i < gio->count;i++) {
+		io_record_t* record = record_create(IO_CMD_COST, 0, message_id, NULL, 0);
+		record->arg = cost;
+		channel_push(&gio->thread[i].outbound, record);
+	}
+}
+
+void
+gate_io_stats(struct gate_io* gio,struct gate_stats* stats) {
+	uint32_t i;
+	for(i = 0;i < gio->count;i++) {
+		gate_stats(gio->thread[i].gate, stats);
+	}
+}
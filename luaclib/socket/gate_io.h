@@ -0,0 +1,28 @@
+#ifndef GATE_IO_H
+#define GATE_IO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define GATE_IO_ACCEPT 	1
+#define GATE_IO_CLOSE 	2
+#define GATE_IO_DATA 	3
+
+struct ev_loop_ctx;
+struct gate_io;
+struct gate_stats;
+
+typedef void (*gate_io_dispatch)(void* ud,int type,uint32_t client_id,int message_id,void* data,size_t size);
+
+struct gate_io* gate_io_create(struct ev_loop_ctx* loop_ctx,uint32_t threads,uint32_t max_client,uint32_t max_freq,uint32_t timeout,uint32_t compress,gate_io_dispatch dispatch,void* ud);
+void gate_io_release(struct gate_io* io);
+void gate_io_attach(struct gate_io* io,int fd,const char* addr);
+int gate_io_send(struct gate_io* io,uint32_t client_id,uint16_t message_id,void* data,size_t size);
+int gate_io_multicast(struct gate_io* io,uint32_t* ids,int count,uint16_t message_id,void* data,size_t size);
+int gate_io_close(struct gate_io* io,uint32_t client_id,int grace);
+void gate_io_aggregate(struct gate_io* io,int on);
+void gate_io_limit(struct gate_io* io,uint32_t rate,uint32_t burst);
+void gate_io_cost(struct gate_io* io,uint16_t message_id,uint8_t cost);
+void gate_io_stats(struct gate_io* io,struct gate_stats* stats);
+
+#endif
@@ -0,0 +1,214 @@
+#include "socket_tcp.h"
+#include "socket_util.h"
+#include "reactor.h"
+#include "common/lock.h"
+
+#define GROUP_SIZE 32
+
+//同一进程里的多个事件循环按组注册,监听线程accept之后把fd通过ev_async转交给组里的循环
+
+typedef struct handoff {
+	struct handoff* next;
+	ev_detach_t detach;
+	char addr[HOST_SIZE];
+} handoff_t;
+
+typedef struct reactor {
+	struct ev_loop_ctx* loop_ctx;
+	struct ev_async notify;
+	mutex_t mutex;
+	handoff_t* first;
+	handoff_t* last;
+	int id;
+	char group[GROUP_SIZE];
+
+	reactor_callback accept_cb;
+	void* userdata;
+} reactor_t;
+
+typedef struct reactor_manager {
+	mutex_t mutex;
+	int size;
+	reactor_t** slot;
+} reactor_manager_t;
+
+static reactor_manager_t* _MANAGER = NULL;
+static pthread_once_t _MANAGER_INIT = PTHREAD_ONCE_INIT;
+
+static void
+create_manager() {
+	reactor_manager_t* rm = malloc(sizeof(*rm));
+	memset(rm,0,sizeof(*rm));
+	rm->size = 8;
+	rm->slot = malloc(sizeof(*rm->slot) * rm->size);
+	memset(rm->slot,0,sizeof(*rm->slot) * rm->size);
+	mutex_init(&rm->mutex);
+
+	_MANAGER = rm;
+}
+
+static void
+add_reactor(reactor_t* reactor) {
+	mutex_lock(&_MANAGER->mutex);
+	int i;
+	for(i = 0;i < _MANAGER->size;i++) {
+		if (_MANAGER->slot[i] == NULL) {
+			_MANAGER->slot[i] = reactor;
+			reactor->id = i;
+			mutex_unlock(&_MANAGER->mutex);
+			return;
+		}
+	}
+
+	int nsize = _MANAGER->size * 2;
+	reactor_t** nslot = malloc(sizeof(*nslot) * nsize);
+	memset(nslot,0,sizeof(*nslot) * nsize);
+	memcpy(nslot,_MANAGER->slot,sizeof(*nslot) * _MANAGER->size);
+
+	nslot[_MANAGER->size] = reactor;
+	reactor->id = _MANAGER->size;
+
+	free(_MANAGER->slot);
+	_MANAGER->slot = nslot;
+	_MANAGER->size = nsize;
+	mutex_unlock(&_MANAGER->mutex);
+}
+
+static void
+_reactor_notify_cb(struct ev_loop* loop,struct ev_async* io,int revents) {
+	reactor_t* reactor = io->data;
+
+	mutex_lock(&reactor->mutex);
+	handoff_t* first = reactor->first;
+	reactor->first = reactor->last = NULL;
+	mutex_unlock(&reactor->mutex);
+
+	while(first) {
+		handoff_t* handoff = first;
+		first = first->next;
+		reactor->accept_cb(reactor,&handoff->detach,handoff->addr,reactor->userdata);
+		free(handoff);
+	}
+}
+
+reactor_t*
+reactor_create(struct ev_loop_ctx* loop_ctx,const char* group,reactor_callback accept_cb,void* userdata) {
+	pthread_once(&_MANAGER_INIT,&create_manager);
+
+	reactor_t* reactor = malloc(sizeof(*reactor));
+	memset(reactor,0,sizeof(*reactor));
+
+	reactor->loop_ctx = loop_ctx;
+	reactor->accept_cb = accept_cb;
+	reactor->userdata = userdata;
+	snprintf(reactor->group,GROUP_SIZE,"%s",group);
+	mutex_init(&reactor->mutex);
+
+	reactor->notify.data = reactor;
+	ev_async_init(&reactor->notify,_reactor_notify_cb);
+	ev_async_start(loop_ctx_get(loop_ctx),&reactor->notify);
+
+	add_reactor(reactor);
+	return reactor;
+}
+
+void
+reactor_release(reactor_t* reactor) {
+	mutex_lock(&_MANAGER->mutex);
+	_MANAGER->slot[reactor->id] = NULL;
+	mutex_unlock(&_MANAGER->mutex);
+
+	ev_async_stop(loop_ctx_get(reactor->loop_ctx),&reactor->notify);
+
+	while(reactor->first) {
+		handoff_t* handoff = reactor->first;
+		reactor->first = reactor->first->next;
+		ev_detach_release(&handoff->detach);
+		free(handoff);
+	}
+	mutex_destroy(&reactor->mutex);
+	free(reactor);
+}
+
+int
+reactor_id(reactor_t* reactor) {
+	return reactor->id;
+}
+
+//key为轮询计数或者地址hash,返回组里第key%count个循环
+int
+reactor_select(const char* group,uint32_t key) {
+	if (_MANAGER == NULL) {
+		return -1;
+	}
+	mutex_lock(&_MANAGER->mutex);
+	int count = 0;
+	int i;
+	for(i = 0;i < _MANAGER->size;i++) {
+		reactor_t* reactor = _MANAGER->slot[i];
+		if (reactor && strcmp(reactor->group,group) == 0) {
+			count++;
+		}
+	}
+
+	int id = -1;
+	if (count > 0) {
+		int index = key % count;
+		for(i = 0;i < _MANAGER->size;i++) {
+			reactor_t* reactor = _MANAGER->slot[i];
+			if (reactor && strcmp(reactor->group,group) == 0) {
+				if (index-- == 0) {
+					id = reactor->id;
+					break;
+				}
+			}
+		}
+	}
+	mutex_unlock(&_MANAGER->mutex);
+	return id;
+}
+
+int
+reactor_exist(int id) {
+	if (_MANAGER == NULL) {
+		return 0;
+	}
+	mutex_lock(&_MANAGER->mutex);
+	int exist = id >= 0 && id < _MANAGER->size && _MANAGER->slot[id] != NULL;
+	mutex_unlock(&_MANAGER->mutex);
+	return exist;
+}
+
+//detach里的数据成功时归目标reactor,失败时还是调用者的
+int
+reactor_handoff(int id,ev_detach_t* detach,const char* addr) {
+	if (_MANAGER == NULL) {
+		return -1;
+	}
+
+	handoff_t* handoff = malloc(sizeof(*handoff));
+	handoff->next = NULL;
+	handoff->detach = *detach;
+	snprintf(handoff->addr,HOST_SIZE,"%s",addr);
+
+	mutex_lock(&_MANAGER->mutex);
+	if (id < 0 || id >= _MANAGER->size || _MANAGER->slot[id] == NULL) {
+		mutex_unlock(&_MANAGER->mutex);
+		free(handoff);
+		return -1;
+	}
+	reactor_t* reactor = _MANAGER->slot[id];
+
+	mutex_lock(&reactor->mutex);
+	if (reactor->first == NULL) {
+		reactor->first = reactor->last = handoff;
+	} else {
+		reactor->last->next = handoff;
+		reactor->last = handoff;
+	}
+	mutex_unlock(&reactor->mutex);
+
+	ev_async_send(loop_ctx_get(reactor->loop_ctx),&reactor->notify);
+	mutex_unlock(&_MANAGER->mutex);
+	return 0;
+}
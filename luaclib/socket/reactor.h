@@ -0,0 +1,19 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+
+struct ev_loop_ctx;
+struct ev_detach;
+struct reactor;
+
+typedef void (*reactor_callback)(struct reactor*,struct ev_detach* detach,const char* addr,void *userdata);
+
+struct reactor* reactor_create(struct ev_loop_ctx* loop_ctx,const char* group,reactor_callback accept_cb,void* userdata);
+void reactor_release(struct reactor* reactor);
+int reactor_id(struct reactor* reactor);
+int reactor_select(const char* group,uint32_t key);
+int reactor_exist(int id);
+int reactor_handoff(int id,struct ev_detach* detach,const char* addr);
+
+#endif
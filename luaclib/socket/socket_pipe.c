@@ -1,3 +1,5 @@
+#include <sys/eventfd.h>
+
 #include "socket_tcp.h"
 #include "socket_util.h"
 #include "socket_pipe.h"
@@ -5,8 +7,7 @@
 typedef struct pipe_session {
 	struct ev_loop_ctx* loop_ctx;
 	struct ev_io io;
-	int recv_fd;
-	int send_fd;
+	struct pipe_channel channel;
 	
 	pipe_session_callback read_cb;
 	void* userdata;
@@ -16,21 +17,23 @@ static void
 _pipe_read_cb(struct ev_loop* loop,struct ev_io* io,int revents) {
 	pipe_session_t* session = io->data;
 
-	for (;;) {
-		struct pipe_message* message = NULL;
-		int n = read(io->fd, &message, sizeof(message));
-		if (n < 0) {
-			if (errno == EINTR)
-				continue;
-			else if (errno == EAGAIN) {
-				return;
-			} else {
-				assert(0);
-			}
-		}
+	//先清门铃再取链,之后推入的生产者一定看到空栈并重新敲门铃
+	uint64_t count;
+	while (read(io->fd, &count, sizeof(count)) < 0 && errno == EINTR);
 
-		assert(n == sizeof(message));
+	struct pipe_message* message = __atomic_exchange_n(&session->channel.head, NULL, __ATOMIC_ACQUIRE);
 
+	struct pipe_message* list = NULL;
+	while (message) {
+		struct pipe_message* next = message->next;
+		message->next = list;
+		list = message;
+		message = next;
+	}
+
+	while (list) {
+		message = list;
+		list = list->next;
 		if (session->read_cb) {
 			session->read_cb(session, message, session->userdata);
 		}
@@ -40,25 +43,22 @@ _pipe_read_cb(struct ev_loop* loop,struct ev_io* io,int revents) {
 
 pipe_session_t*
 pipe_sesson_new(struct ev_loop_ctx* loop_ctx) {
-	int fd[2];
-	if (pipe(fd)) {
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0) {
 		return NULL;
 	}
 
-	socket_nonblock(fd[0]);
-	socket_nonblock(fd[1]);
-
 	pipe_session_t* session = malloc(sizeof(*session));
 	memset(session, 0, sizeof(*session));
 
 	session->loop_ctx = loop_ctx;
 
-	session->recv_fd = fd[0];
-	session->send_fd = fd[1];
+	session->channel.head = NULL;
+	session->channel.fd = fd;
 
 	session->io.data = session;
 
-	ev_io_init(&session->io, _pipe_read_cb, session->recv_fd, EV_READ);
+	ev_io_init(&session->io, _pipe_read_cb, fd, EV_READ);
 	ev_io_start(loop_ctx_get(loop_ctx), &session->io);
 
 	return session;
@@ -67,19 +67,26 @@ pipe_sesson_new(struct ev_loop_ctx* loop_ctx) {
 void
 pipe_session_destroy(pipe_session_t* session) {
 	ev_io_stop(loop_ctx_get(session->loop_ctx), &session->io);
-	close(session->recv_fd);
-	close(session->send_fd);
+	close(session->channel.fd);
+
+	struct pipe_message* message = __atomic_exchange_n(&session->channel.head, NULL, __ATOMIC_ACQUIRE);
+	while (message) {
+		struct pipe_message* next = message->next;
+		free(message->data);
+		free(message);
+		message = next;
+	}
 	free(session);
 }
 
-int
-pipe_session_write(pipe_session_t* session, void* data, size_t size) {
-	return socket_pipe_write(session->send_fd, data, size);
+void
+pipe_session_write(pipe_session_t* session, struct pipe_message* message) {
+	pipe_channel_push(&session->channel, message);
 }
 
-int
-pipe_session_write_fd(pipe_session_t* session) {
-	return session->send_fd;
+struct pipe_channel*
+pipe_session_channel(pipe_session_t* session) {
+	return &session->channel;
 }
 
 void
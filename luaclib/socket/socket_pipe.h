@@ -1,6 +1,10 @@
 #ifndef SOCKET_PIPE_H
 #define SOCKET_PIPE_H
 
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+
 
 struct pipe_message {
 	struct pipe_message* next;
@@ -10,16 +14,52 @@ struct pipe_message {
 	size_t size;
 };
 
+//多个生产线程共享的侵入式消息栈,只有栈从空变非空时才敲一次eventfd
+//worker和tp在各自的so里,只能通过头文件里的inline函数往里推
+struct pipe_channel {
+	struct pipe_message* head;
+	int fd;
+};
+
 struct ev_loop_ctx;
 struct pipe_session;
 
 typedef void (*pipe_session_callback)(struct pipe_session*,struct pipe_message* message,void *userdata);
 
+//first开始以NULL结尾的整条链一次推入,链内顺序保持不变
+static inline void
+pipe_channel_push(struct pipe_channel* channel, struct pipe_message* first) {
+	if (!first) {
+		return;
+	}
+	//栈是后进先出,先在本线程把链反转,消费端整体反转后就是全局的先后顺序
+	struct pipe_message* last = first;
+	struct pipe_message* reverse = NULL;
+	while (first) {
+		struct pipe_message* next = first->next;
+		first->next = reverse;
+		reverse = first;
+		first = next;
+	}
+
+	struct pipe_message* head = __atomic_load_n(&channel->head, __ATOMIC_RELAXED);
+	do {
+		last->next = head;
+	} while (!__atomic_compare_exchange_n(&channel->head, &head, reverse, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	if (head) {
+		//消费端还没取走上一批,门铃已经响过了
+		return;
+	}
+
+	uint64_t one = 1;
+	while (write(channel->fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
 
 struct pipe_session* pipe_sesson_new(struct ev_loop_ctx* loop_ctx);
 void pipe_session_destroy(struct pipe_session* session);
-int pipe_session_write_fd(struct pipe_session* session);
-int pipe_session_write(struct pipe_session* session, void* data, size_t size);
+struct pipe_channel* pipe_session_channel(struct pipe_session* session);
+void pipe_session_write(struct pipe_session* session, struct pipe_message* message);
 void pipe_session_setcb(struct pipe_session* session, pipe_session_callback read_cb, void* userdata);
 
-#endif
\ No newline at end of file
+#endif
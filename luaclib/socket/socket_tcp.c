@@ -3,12 +3,29 @@
 
 #define MIN_BUFFER_SIZE 256
 #define MAX_BUFFER_SIZE 1024*1024
+#define DEFAULT_READ_BUDGET 64*1024
+#define ACCEPT_BUDGET 64
+#define MAX_SEP_SIZE 16
 
+#define SLAB_MIN_SHIFT 		8
+#define SLAB_MAX_SHIFT 		20
+#define SLAB_CLASS_SIZE 	(SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_CACHED_SIZE 	(2 * 1024 * 1024)
+
+typedef struct slab_block {
+	struct slab_block* next;
+} slab_block_t;
+
+typedef struct slab_class {
+	slab_block_t* freelist;
+	int count;
+} slab_class_t;
 
 typedef struct data_buffer {
 	struct data_buffer* prev;
 	struct data_buffer* next;
 	void* data;
+	struct ev_shared* shared;
 	int size;
 	int wpos;
 	int rpos;
@@ -20,9 +37,14 @@ typedef struct ev_buffer {
 	int total;
 } ev_buffer_t;
 
+struct ev_session;
+
 typedef struct ev_loop_ctx {
 	struct ev_loop* loop;
 	data_buffer_t* freelist;
+	struct ev_prepare flusher;
+	struct ev_session* dirty;
+	slab_class_t slab[SLAB_CLASS_SIZE];
 } ev_loop_ctx_t;
 
 typedef struct ev_listener {
@@ -31,6 +53,8 @@ typedef struct ev_listener {
 	int fd;
 	listener_callback accept_cb;
 	void* userdata;
+	int executing;
+	int closed;
 } ev_listener_t;
 
 typedef struct ev_session {
@@ -42,9 +66,20 @@ typedef struct ev_session {
 	int alive;
 	
 	int threshold;
+	int budget;
+	int lowwater;
 	ev_buffer_t input;
 	ev_buffer_t output;
 
+	int search_offset;
+	int search_sep_len;
+	char search_sep[MAX_SEP_SIZE];
+
+	int cork;
+	int dirty;
+	struct ev_session* dirty_prev;
+	struct ev_session* dirty_next;
+
 	ev_session_callback read_cb;
 	ev_session_callback write_cb;
 	ev_session_callback event_cb;
@@ -54,6 +89,8 @@ typedef struct ev_session {
 
 void ev_session_free(ev_session_t* ev_session);
 void ev_session_disable(ev_session_t* ev_session,int ev);
+static inline void output_append(ev_session_t* ev_session,char* data,size_t size,int offset,struct ev_shared* shared);
+static size_t input_consume(ev_session_t* ev_session,char* result,size_t size);
 
 static inline struct data_buffer*
 buffer_next(ev_loop_ctx_t* loop_ctx) {
@@ -65,6 +102,7 @@ buffer_next(ev_loop_ctx_t* loop_ctx) {
 		db = malloc(sizeof(*db));
 	}
 	db->data = NULL;
+	db->shared = NULL;
 	db->wpos = db->rpos = 0;
 	db->size = 0;
 	db->prev = NULL;
@@ -79,6 +117,61 @@ buffer_reclaim(ev_loop_ctx_t* loop_ctx,data_buffer_t* db) {
 	loop_ctx->freelist = db;
 }
 
+//接收缓冲按2的幂分级缓存在loop_ctx上,每级最多缓存SLAB_CACHED_SIZE字节
+static inline int
+slab_index(int size) {
+	int index = 0;
+	while((MIN_BUFFER_SIZE << index) < size && index < SLAB_CLASS_SIZE - 1) {
+		index++;
+	}
+	return index;
+}
+
+static inline void*
+slab_alloc(ev_loop_ctx_t* loop_ctx,int* size) {
+	int index = slab_index(*size);
+	*size = MIN_BUFFER_SIZE << index;
+
+	slab_class_t* slab = &loop_ctx->slab[index];
+	if (slab->freelist) {
+		slab_block_t* block = slab->freelist;
+		slab->freelist = block->next;
+		slab->count--;
+		return block;
+	}
+	return malloc(*size);
+}
+
+static inline void
+slab_free(ev_loop_ctx_t* loop_ctx,void* data,int size) {
+	int index = slab_index(size);
+	assert(size == MIN_BUFFER_SIZE << index);
+
+	slab_class_t* slab = &loop_ctx->slab[index];
+	if (slab->count >= SLAB_CACHED_SIZE / size) {
+		free(data);
+		return;
+	}
+	slab_block_t* block = data;
+	block->next = slab->freelist;
+	slab->freelist = block;
+	slab->count++;
+}
+
+static inline void
+slab_clean(ev_loop_ctx_t* loop_ctx) {
+	int i;
+	for(i = 0;i < SLAB_CLASS_SIZE;i++) {
+		slab_class_t* slab = &loop_ctx->slab[i];
+		while(slab->freelist) {
+			slab_block_t* block = slab->freelist;
+			slab->freelist = block->next;
+			free(block);
+		}
+		slab->count = 0;
+	}
+}
+
 static inline void
 buffer_append(ev_buffer_t* ev_buffer,data_buffer_t* db) {
 	ev_buffer->total += db->wpos - db->rpos;
@@ -93,12 +186,32 @@ buffer_append(ev_buffer_t* ev_buffer,data_buffer_t* db) {
 	}
 }
 
+static inline void
+buffer_data_free(data_buffer_t* db) {
+	if (db->shared) {
+		ev_shared_release(db->shared);
+		db->shared = NULL;
+	} else {
+		free(db->data);
+	}
+}
+
 static inline void
 buffer_release(ev_buffer_t* ev_buffer) {
 	while(ev_buffer->head) {
 		data_buffer_t* tmp = ev_buffer->head;
 		ev_buffer->head = ev_buffer->head->next;
-		free(tmp->data);
+		buffer_data_free(tmp);
+		free(tmp);
+	}
+}
+
+static inline void
+input_release(ev_loop_ctx_t* loop_ctx,ev_buffer_t* ev_buffer) {
+	while(ev_buffer->head) {
+		data_buffer_t* tmp = ev_buffer->head;
+		ev_buffer->head = ev_buffer->head->next;
+		slab_free(loop_ctx,tmp->data,tmp->size);
 		free(tmp);
 	}
 }
@@ -107,26 +220,80 @@ static void
 _ev_accept_cb(struct ev_loop* loop,struct ev_io* io,int revents) {
 	ev_listener_t* listener = io->data;
 
-	const char addr[HOST_SIZE] = {0};
-	int accept_fd = socket_accept(listener->fd,(char*)addr,HOST_SIZE);
-	if (accept_fd < 0) {
-		fprintf(stderr,"accept fd error:%s\n",addr);
-		return;
+	//一次把已完成握手的连接接完(到EAGAIN或者超出预算),回调里可能关掉listener,延迟到循环结束再释放
+	listener->executing = 1;
+	int i;
+	for(i = 0;i < ACCEPT_BUDGET && !listener->closed;i++) {
+		char addr[HOST_SIZE] = {0};
+		int accept_fd = socket_accept(listener->fd,addr,HOST_SIZE);
+		if (accept_fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				fprintf(stderr,"accept fd error:%s\n",addr);
+			}
+			break;
+		}
+		listener->accept_cb(listener,accept_fd,addr,listener->userdata);
+	}
+	listener->executing = 0;
+
+	if (listener->closed) {
+		free(listener);
 	}
-	listener->accept_cb(listener,accept_fd,addr,listener->userdata);
+}
+
+static inline data_buffer_t*
+input_tail(ev_session_t* ev_session) {
+	//尾块还有足够空间时直接追加,已经读掉大半的块先把剩余数据挪到头部
+	data_buffer_t* rdb = ev_session->input.tail;
+	if (rdb) {
+		if (rdb->size - rdb->wpos >= MIN_BUFFER_SIZE) {
+			return rdb;
+		}
+		if (rdb->rpos >= rdb->size / 2) {
+			memmove(rdb->data,rdb->data + rdb->rpos,rdb->wpos - rdb->rpos);
+			rdb->wpos -= rdb->rpos;
+			rdb->rpos = 0;
+			if (rdb->size - rdb->wpos >= MIN_BUFFER_SIZE) {
+				return rdb;
+			}
+		}
+	}
+	return NULL;
 }
 
 static void
 _ev_read_cb(struct ev_loop* loop,struct ev_io* io,int revents) {
 	ev_session_t* ev_session = io->data;
+	ev_loop_ctx_t* loop_ctx = ev_session->loop_ctx;
 
-	struct data_buffer* rdb = buffer_next(ev_session->loop_ctx);
-	rdb->data = malloc(ev_session->threshold);
-	rdb->size = ev_session->threshold;
+	struct data_buffer* rdb = NULL;
 	int fail = 0;
-	//一次性接完数据，再回调(为了预防恶意流，理论上应该接一次回调一次，在上层判断数据合法性)
+	int total = 0;
+	//一次性接完数据(读到EAGAIN或者超出预算)，再回调(为了预防恶意流，理论上应该接一次回调一次，在上层判断数据合法性)
 	for(;;) {
-		int n = (int)read(ev_session->fd, rdb->data + rdb->wpos, rdb->size - rdb->wpos);
+		struct iovec iov[2];
+		int count = 0;
+		int left = 0;
+		data_buffer_t* tail = input_tail(ev_session);
+		if (tail) {
+			left = tail->size - tail->wpos;
+			iov[count].iov_base = tail->data + tail->wpos;
+			iov[count].iov_len = left;
+			count++;
+		}
+		if (!rdb) {
+			rdb = buffer_next(loop_ctx);
+			rdb->size = ev_session->threshold;
+			rdb->data = slab_alloc(loop_ctx,&rdb->size);
+		}
+		iov[count].iov_base = rdb->data;
+		iov[count].iov_len = rdb->size;
+		count++;
+
+		int n = (int)readv(ev_session->fd, iov, count);
 		if (n < 0) {
 			if (errno) {
 				if (errno == EINTR) {
@@ -144,22 +311,49 @@ _ev_read_cb(struct ev_loop* loop,struct ev_io* io,int revents) {
 			fail = 1;
 			break;
 		} else {
-			rdb->wpos += n;
-	
-			if (rdb->wpos == rdb->size) {
+			total += n;
+			if (tail) {
+				int sz = n < left ? n : left;
+				tail->wpos += sz;
+				ev_session->input.total += sz;
+				n -= sz;
+			}
+			if (n > 0) {
+				rdb->wpos = n;
+				buffer_append(&ev_session->input,rdb);
+			}
+
+			if (n == rdb->size) {
 				ev_session->threshold *= 2;
 				if (ev_session->threshold > MAX_BUFFER_SIZE)
 					ev_session->threshold = MAX_BUFFER_SIZE;
+				rdb = NULL;
 			} else {
 				ev_session->threshold /= 2;
 				if (ev_session->threshold < MIN_BUFFER_SIZE)
 					ev_session->threshold = MIN_BUFFER_SIZE;
+				if (n > 0) {
+					rdb = NULL;
+				}
+				//没读满说明内核缓冲区已经读空了
+				break;
+			}
+
+			if (total >= ev_session->budget) {
+				break;
 			}
-			break;
 		}
 	}
 
-	buffer_append(&ev_session->input,rdb);
+	if (rdb) {
+		slab_free(loop_ctx,rdb->data,rdb->size);
+		buffer_reclaim(loop_ctx,rdb);
+	}
+
+	//这一轮已经读到的数据先交给上层,EOF和错误留到下一次可读事件再报
+	if (fail && total > 0) {
+		fail = 0;
+	}
 
 	if (fail) {
 		ev_session_disable(ev_session,EV_READ | EV_WRITE);
@@ -174,34 +368,67 @@ _ev_read_cb(struct ev_loop* loop,struct ev_io* io,int revents) {
 	}
 }
 
+static inline int
+output_gather(ev_session_t* ev_session,struct iovec* iov,int* size) {
+	int count = 0;
+	int total = 0;
+	data_buffer_t* wdb = ev_session->output.head;
+	while(wdb && count < IOV_MAX) {
+		iov[count].iov_base = wdb->data + wdb->rpos;
+		iov[count].iov_len = wdb->wpos - wdb->rpos;
+		total += wdb->wpos - wdb->rpos;
+		count++;
+		wdb = wdb->next;
+	}
+	*size = total;
+	return count;
+}
+
+static inline void
+output_consume(ev_session_t* ev_session,int size) {
+	ev_session->output.total -= size;
+	while(size > 0) {
+		data_buffer_t* wdb = ev_session->output.head;
+		int left = wdb->wpos - wdb->rpos;
+		if (size < left) {
+			wdb->rpos += size;
+			break;
+		}
+		size -= left;
+		buffer_data_free(wdb);
+		ev_session->output.head = wdb->next;
+		buffer_reclaim(ev_session->loop_ctx,wdb);
+	}
+	if (ev_session->output.head == NULL) {
+		ev_session->output.tail = NULL;
+	}
+}
+
 static void
 _ev_write_cb(struct ev_loop* loop,struct ev_io* io,int revents) {
 	ev_session_t* ev_session = io->data;
+	int origin = ev_session->output.total;
 
+	//把待发送的数据块合并成一次writev,直到发完或者写满内核缓冲区
+	struct iovec iov[IOV_MAX];
 	while(ev_session->output.head != NULL) {
-		struct data_buffer* wdb = ev_session->output.head;
-		int left = wdb->wpos - wdb->rpos;
-		int total = socket_write(ev_session->fd,wdb->data + wdb->rpos,left);
+		int size = 0;
+		int count = output_gather(ev_session,iov,&size);
+		int total = socket_writev(ev_session->fd,iov,count);
 		if (total < 0) {
 			ev_session_disable(ev_session,EV_READ | EV_WRITE);
 			ev_session->alive = 0;
 			if (ev_session->event_cb)
 				ev_session->event_cb(ev_session,ev_session->userdata);
 			return;
-		} else {
-			ev_session->output.total -= total;
-			if (total == left) {
-				free(wdb->data);
-				ev_session->output.head = wdb->next;
-				buffer_reclaim(ev_session->loop_ctx,wdb);
-				if (ev_session->output.head == NULL) {
-					ev_session->output.head = ev_session->output.tail = NULL;
-					break;
-				}
-			} else {
-				wdb->rpos += total;
-				return;
+		}
+		output_consume(ev_session,total);
+		if (total < size) {
+			//没发完,但是已经降到低水位以下
+			if (ev_session->write_cb && origin > ev_session->lowwater && ev_session->output.total <= ev_session->lowwater) {
+				ev_session->write_cb(ev_session,ev_session->userdata);
 			}
+			return;
 		}
 	}
 
@@ -212,11 +439,60 @@ _ev_write_cb(struct ev_loop* loop,struct ev_io* io,int revents) {
 	}
 }
 
+static inline void
+dirty_link(ev_session_t* ev_session) {
+	ev_loop_ctx_t* loop_ctx = ev_session->loop_ctx;
+	ev_session->dirty = 1;
+	ev_session->dirty_prev = NULL;
+	ev_session->dirty_next = loop_ctx->dirty;
+	if (loop_ctx->dirty) {
+		loop_ctx->dirty->dirty_prev = ev_session;
+	}
+	loop_ctx->dirty = ev_session;
+	if (!ev_is_active(&loop_ctx->flusher)) {
+		ev_prepare_start(loop_ctx->loop,&loop_ctx->flusher);
+	}
+}
+
+static inline void
+dirty_unlink(ev_session_t* ev_session) {
+	if (!ev_session->dirty) {
+		return;
+	}
+	if (ev_session->dirty_prev) {
+		ev_session->dirty_prev->dirty_next = ev_session->dirty_next;
+	} else {
+		ev_session->loop_ctx->dirty = ev_session->dirty_next;
+	}
+	if (ev_session->dirty_next) {
+		ev_session->dirty_next->dirty_prev = ev_session->dirty_prev;
+	}
+	ev_session->dirty = 0;
+	ev_session->dirty_prev = ev_session->dirty_next = NULL;
+}
+
+//每轮循环阻塞之前,把cork模式下攒起来的输出各用一次writev发出去
+static void
+_ev_flush_cb(struct ev_loop* loop,struct ev_prepare* io,int revents) {
+	ev_loop_ctx_t* loop_ctx = io->data;
+	while(loop_ctx->dirty) {
+		ev_session_t* ev_session = loop_ctx->dirty;
+		dirty_unlink(ev_session);
+		if (ev_session->alive && !ev_is_active(&ev_session->wio) && ev_session->output.head != NULL) {
+			ev_io_start(loop,&ev_session->wio);
+			_ev_write_cb(loop,&ev_session->wio,EV_WRITE);
+		}
+	}
+	ev_prepare_stop(loop,io);
+}
+
 ev_loop_ctx_t*
 loop_ctx_create() {
 	ev_loop_ctx_t* loop_ctx = malloc(sizeof(*loop_ctx));
 	memset(loop_ctx,0,sizeof(*loop_ctx));
 	loop_ctx->loop = ev_loop_new(0);
+	loop_ctx->flusher.data = loop_ctx;
+	ev_prepare_init(&loop_ctx->flusher,_ev_flush_cb);
 	return loop_ctx;
 }
 
@@ -229,6 +505,7 @@ loop_ctx_release(ev_loop_ctx_t* loop_ctx) {
 		loop_ctx->freelist = loop_ctx->freelist->next;
 		free(tmp);
 	}
+	slab_clean(loop_ctx);
 	free(loop_ctx);
 }
 
@@ -259,6 +536,7 @@ loop_ctx_clean(ev_loop_ctx_t* loop_ctx) {
 		loop_ctx->freelist = loop_ctx->freelist->next;
 		free(tmp);
 	}
+	slab_clean(loop_ctx);
 }
 
 ev_listener_t*
@@ -272,6 +550,8 @@ ev_listener_bind(struct ev_loop_ctx* loop_ctx,struct sockaddr* addr, int addrlen
 	listener->fd = fd;
 	listener->accept_cb = accept_cb;
 	listener->userdata = userdata;
+	listener->executing = 0;
+	listener->closed = 0;
 
 	listener->rio.data = listener;
 	ev_io_init(&listener->rio,_ev_accept_cb,fd,EV_READ);
@@ -299,16 +579,27 @@ ev_listener_free(ev_listener_t* listener) {
 		ev_io_stop(listener->loop_ctx->loop, &listener->rio);
 	}
 	close(listener->fd);
+	if (listener->executing) {
+		listener->closed = 1;
+		return;
+	}
 	free(listener);
 }
 
+size_t
+ev_session_size() {
+	return sizeof(ev_session_t);
+}
+
+//在调用者提供的内存上初始化session,配合ev_session_fini使用,方便上层把session和自己的结构放在一起
 ev_session_t*
-ev_session_bind(struct ev_loop_ctx* loop_ctx,int fd) {
-	ev_session_t* ev_session = malloc(sizeof(*ev_session));
+ev_session_init(void* mem,struct ev_loop_ctx* loop_ctx,int fd) {
+	ev_session_t* ev_session = mem;
 	memset(ev_session,0,sizeof(*ev_session));
 	ev_session->loop_ctx = loop_ctx;
 	ev_session->fd = fd;
 	ev_session->threshold = MIN_BUFFER_SIZE;
+	ev_session->budget = DEFAULT_READ_BUDGET;
 
 	ev_session->rio.data = ev_session;
 	ev_io_init(&ev_session->rio,_ev_read_cb,ev_session->fd,EV_READ);
@@ -321,6 +612,11 @@ ev_session_bind(struct ev_loop_ctx* loop_ctx,int fd) {
 	return ev_session;
 }
 
+ev_session_t*
+ev_session_bind(struct ev_loop_ctx* loop_ctx,int fd) {
+	return ev_session_init(malloc(sizeof(ev_session_t)),loop_ctx,fd);
+}
+
 ev_session_t*
 ev_session_connect(struct ev_loop_ctx* loop_ctx,struct sockaddr* addr, int addrlen, int block,int* status) {
 	int result = 0;
@@ -340,15 +636,103 @@ ev_session_connect(struct ev_loop_ctx* loop_ctx,struct sockaddr* addr, int addrl
 }
 
 void
-ev_session_free(ev_session_t* ev_session) {
+ev_session_fini(ev_session_t* ev_session) {
 	ev_session->alive = 0;
 	close(ev_session->fd);
 	ev_session_disable(ev_session,EV_READ | EV_WRITE);
+	dirty_unlink(ev_session);
+
+	input_release(ev_session->loop_ctx,&ev_session->input);
+	buffer_release(&ev_session->output);
+	ev_session->input.head = ev_session->input.tail = NULL;
+	ev_session->output.head = ev_session->output.tail = NULL;
+}
+
+void
+ev_session_free(ev_session_t* ev_session) {
+	ev_session_fini(ev_session);
+	free(ev_session);
+}
+
+//把fd从当前循环上摘下来交给别的循环,输出先同步发一次,发不完的输出和还没读的输入拷出来一起带走
+int
+ev_session_detach(ev_session_t* ev_session,ev_detach_t* detach) {
+	memset(detach,0,sizeof(*detach));
+
+	struct iovec iov[IOV_MAX];
+	while(ev_session->output.head != NULL) {
+		int size = 0;
+		int count = output_gather(ev_session,iov,&size);
+		int total = socket_writev(ev_session->fd,iov,count);
+		if (total <= 0) {
+			break;
+		}
+		output_consume(ev_session,total);
+	}
+
+	if (ev_session->output.total > 0) {
+		detach->output_size = ev_session->output.total;
+		detach->output = malloc(detach->output_size);
+		size_t offset = 0;
+		data_buffer_t* wdb = ev_session->output.head;
+		while(wdb) {
+			memcpy(detach->output + offset,wdb->data + wdb->rpos,wdb->wpos - wdb->rpos);
+			offset += wdb->wpos - wdb->rpos;
+			wdb = wdb->next;
+		}
+	}
+
+	if (ev_session->input.total > 0) {
+		detach->input_size = ev_session->input.total;
+		detach->input = malloc(detach->input_size);
+		input_consume(ev_session,detach->input,detach->input_size);
+	}
+
+	int fd = ev_session->fd;
+	detach->fd = fd;
+	ev_session->alive = 0;
+	ev_session_disable(ev_session,EV_READ | EV_WRITE);
+	dirty_unlink(ev_session);
 
-	buffer_release(&ev_session->input);
+	input_release(ev_session->loop_ctx,&ev_session->input);
 	buffer_release(&ev_session->output);
 
 	free(ev_session);
+	return fd;
+}
+
+//接上别的循环转交过来的连接,带过来的输入放回输入缓冲,输出排在队列最前面,数据的所有权交给session
+void
+ev_session_attach(ev_session_t* ev_session,ev_detach_t* detach) {
+	ev_loop_ctx_t* loop_ctx = ev_session->loop_ctx;
+	size_t offset = 0;
+	while(offset < detach->input_size) {
+		data_buffer_t* rdb = buffer_next(loop_ctx);
+		rdb->size = detach->input_size - offset > MAX_BUFFER_SIZE ? MAX_BUFFER_SIZE : detach->input_size - offset;
+		rdb->data = slab_alloc(loop_ctx,&rdb->size);
+		int size = detach->input_size - offset > rdb->size ? rdb->size : detach->input_size - offset;
+		memcpy(rdb->data,detach->input + offset,size);
+		rdb->wpos = size;
+		buffer_append(&ev_session->input,rdb);
+		offset += size;
+	}
+	free(detach->input);
+
+	if (detach->output_size > 0) {
+		output_append(ev_session,detach->output,detach->output_size,0,NULL);
+		ev_session_enable(ev_session,EV_WRITE);
+	}
+
+	detach->input = detach->output = NULL;
+	detach->input_size = detach->output_size = 0;
+}
+
+void
+ev_detach_release(ev_detach_t* detach) {
+	close(detach->fd);
+	free(detach->input);
+	free(detach->output);
+	detach->input = detach->output = NULL;
 }
 
 void
@@ -387,6 +771,25 @@ ev_session_disable(ev_session_t* ev_session,int ev) {
 	} 
 }
 
+void
+ev_session_set_cork(ev_session_t* ev_session,int cork) {
+	ev_session->cork = cork;
+}
+
+void
+ev_session_set_lowwater(ev_session_t* ev_session,int lowwater) {
+	if (lowwater < 0)
+		lowwater = 0;
+	ev_session->lowwater = lowwater;
+}
+
+void
+ev_session_set_budget(ev_session_t* ev_session,int budget) {
+	if (budget < MIN_BUFFER_SIZE)
+		budget = MIN_BUFFER_SIZE;
+	ev_session->budget = budget;
+}
+
 int
 ev_session_fd(ev_session_t* ev_session) {
 	return ev_session->fd;
@@ -402,6 +805,7 @@ ev_session_output_size(ev_session_t* ev_session) {
 	return ev_session->output.total;
 }
 
+//1:匹配,0:不匹配,-1:数据不够还不能确定
 static inline int
 check_eol(data_buffer_t* db,int from,const char* sep,size_t sep_len) {
 	while (db) {
@@ -418,32 +822,65 @@ check_eol(data_buffer_t* db,int from,const char* sep,size_t sep_len) {
 		db = db->next;
 		sep += sz;
 		sep_len -= sz;
-		from = 0;
+		if (db)
+			from = db->rpos;
 	}
-	return 0;
+	return -1;
 }
 
+//从上次扫描停下的位置继续找,保证同一个分隔符在多次调用之间是线性的
 static inline int
 search_eol(ev_session_t* ev_session,const char* sep,size_t sep_len) {
+	if (sep_len == 0) {
+		return -1;
+	}
+
+	if (sep_len != ev_session->search_sep_len || memcmp(ev_session->search_sep,sep,sep_len) != 0) {
+		ev_session->search_offset = 0;
+		ev_session->search_sep_len = 0;
+		if (sep_len <= MAX_SEP_SIZE) {
+			memcpy(ev_session->search_sep,sep,sep_len);
+			ev_session->search_sep_len = sep_len;
+		}
+	}
+
+	int offset = ev_session->search_offset;
+	int base = 0;
 	data_buffer_t* current = ev_session->input.head;
-	int offset = 0;
+	while(current && base + (current->wpos - current->rpos) <= offset) {
+		base += current->wpos - current->rpos;
+		current = current->next;
+	}
+
 	while(current) {
-		int i = current->rpos;
-		for(; i < current->wpos;i++) {
-			int ret = check_eol(current,i,sep,sep_len);
+		int from = current->rpos + offset - base;
+		while(from < current->wpos) {
+			char* found = memchr(current->data + from,sep[0],current->wpos - from);
+			if (!found) {
+				break;
+			}
+			from = found - (char*)current->data;
+			int ret = check_eol(current,from,sep,sep_len);
 			if (ret == 1) {
-				return offset + sep_len;
+				ev_session->search_offset = 0;
+				return base + from - current->rpos + sep_len;
+			} else if (ret < 0) {
+				ev_session->search_offset = base + from - current->rpos;
+				return -1;
 			}
-			++offset;
+			from++;
 		}
+		base += current->wpos - current->rpos;
+		offset = base;
 		current = current->next;
 	}
 
+	ev_session->search_offset = base;
 	return -1;
 }
 
-size_t 
-ev_session_read(struct ev_session* ev_session,char* result,size_t size) {
+static size_t
+input_consume(ev_session_t* ev_session,char* result,size_t size) {
 	if (size > ev_session->input.total)
 		size = ev_session->input.total;
 
@@ -452,7 +889,8 @@ ev_session_read(struct ev_session* ev_session,char* result,size_t size) {
 	while (need > 0) {
 		data_buffer_t* rdb = ev_session->input.head;
 		if (rdb->rpos + need < rdb->wpos) {
-			memcpy(result + offset,rdb->data + rdb->rpos,need);
+			if (result)
+				memcpy(result + offset,rdb->data + rdb->rpos,need);
 			rdb->rpos += need;
 
 			offset += need;
@@ -460,10 +898,11 @@ ev_session_read(struct ev_session* ev_session,char* result,size_t size) {
 			need = 0;
 		} else {
 			int left = rdb->wpos - rdb->rpos;
-			memcpy(result + offset,rdb->data + rdb->rpos,left);
+			if (result)
+				memcpy(result + offset,rdb->data + rdb->rpos,left);
 			offset += left;
 			need -= left;
-			free(rdb->data);
+			slab_free(ev_session->loop_ctx,rdb->data,rdb->size);
 			
 			data_buffer_t* tmp = ev_session->input.head;
 
@@ -478,9 +917,36 @@ ev_session_read(struct ev_session* ev_session,char* result,size_t size) {
 	}
 	ev_session->input.total -= size;
 
+	ev_session->search_offset -= size;
+	if (ev_session->search_offset < 0)
+		ev_session->search_offset = 0;
+
 	return size;
 }
 
+size_t 
+ev_session_read(struct ev_session* ev_session,char* result,size_t size) {
+	return input_consume(ev_session,result,size);
+}
+
+//数据在第一个块里连续时直接返回块内指针,在ev_session_drain之前一直有效
+char*
+ev_session_peek(struct ev_session* ev_session,size_t size) {
+	data_buffer_t* rdb = ev_session->input.head;
+	if (!rdb || size == 0) {
+		return NULL;
+	}
+	if (rdb->wpos - rdb->rpos < size) {
+		return NULL;
+	}
+	return rdb->data + rdb->rpos;
+}
+
+size_t
+ev_session_drain(struct ev_session* ev_session,size_t size) {
+	return input_consume(ev_session,NULL,size);
+}
+
 char* ev_session_read_util(ev_session_t* ev_session,const char* sep,size_t size,char* out,size_t out_size,size_t* length) {
 	int offset = search_eol(ev_session,sep,size);
 	if (offset < 0) {
@@ -495,11 +961,35 @@ char* ev_session_read_util(ev_session_t* ev_session,const char* sep,size_t size,
 	return result;
 }
 
-int
-ev_session_write(ev_session_t* ev_session,char* data,size_t size) {
+static inline void
+output_append(ev_session_t* ev_session,char* data,size_t size,int offset,struct ev_shared* shared) {
+	struct data_buffer* wdb = buffer_next(ev_session->loop_ctx);
+	wdb->data = data;
+	wdb->rpos = offset;
+	wdb->wpos = size;
+	wdb->size = size;
+	wdb->shared = shared;
+	if (shared) {
+		shared->ref++;
+	}
+	buffer_append(&ev_session->output,wdb);
+}
+
+//shared不为空时data指向共享缓冲,写完只减引用,不释放data
+static int
+output_write(ev_session_t* ev_session,char* data,size_t size,struct ev_shared* shared) {
 	if (ev_session->alive == 0)
 		return -1;
 
+	//cork模式先挂到输出队列,等本轮循环结束统一flush
+	if (ev_session->cork && !ev_is_active(&ev_session->wio)) {
+		output_append(ev_session,data,size,0,shared);
+		if (!ev_session->dirty) {
+			dirty_link(ev_session);
+		}
+		return 0;
+	}
+
 	if (!ev_is_active(&ev_session->wio)) {
 		int total = socket_write(ev_session->fd,data,size);
 		if (total < 0) {
@@ -510,28 +1000,45 @@ ev_session_write(ev_session_t* ev_session,char* data,size_t size) {
 			return -1;
 		} else {
 			if (total == size) {
-				free(data);
+				if (!shared) {
+					free(data);
+				}
 				if (ev_session->write_cb) {
 					ev_session->write_cb(ev_session,ev_session->userdata);
 				}
 			} else {
-				struct data_buffer* wdb = buffer_next(ev_session->loop_ctx);
-				wdb->data = data;
-				wdb->rpos = total;
-				wdb->wpos = size;
-				wdb->size = size;
-				buffer_append(&ev_session->output,wdb);
+				output_append(ev_session,data,size,total,shared);
 				ev_io_start(ev_session->loop_ctx->loop,&ev_session->wio);
 			}
 			return total;
 		}
 	} else {
-		struct data_buffer* wdb = buffer_next(ev_session->loop_ctx);
-		wdb->data = data;
-		wdb->rpos = 0;
-		wdb->wpos = size;
-		wdb->size = size;
-		buffer_append(&ev_session->output,wdb);
+		output_append(ev_session,data,size,0,shared);
 		return 0;
 	}
 }
+
+int
+ev_session_write(ev_session_t* ev_session,char* data,size_t size) {
+	return output_write(ev_session,data,size,NULL);
+}
+
+int
+ev_session_write_shared(ev_session_t* ev_session,struct ev_shared* shared) {
+	return output_write(ev_session,shared->data,shared->size,shared);
+}
+
+struct ev_shared*
+ev_shared_create(size_t size) {
+	struct ev_shared* shared = malloc(sizeof(*shared) + size);
+	shared->ref = 1;
+	shared->size = size;
+	return shared;
+}
+
+void
+ev_shared_release(struct ev_shared* shared) {
+	if (--shared->ref == 0) {
+		free(shared);
+	}
+}
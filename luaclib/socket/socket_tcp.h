@@ -12,6 +12,22 @@ struct ev_loop_ctx;
 struct ev_listener;
 struct ev_session;
 
+//多个session共用的只读输出缓冲,引用计数只在所属loop线程里增减
+struct ev_shared {
+	int ref;
+	size_t size;
+	char data[0];
+};
+
+//从循环上摘下来的连接,带着还没读的输入和还没发完的输出
+typedef struct ev_detach {
+	int fd;
+	char* input;
+	size_t input_size;
+	char* output;
+	size_t output_size;
+} ev_detach_t;
+
 typedef void (*listener_callback)(struct ev_listener*,int fd,const char* addr, void *userdata);
 typedef void (*ev_session_callback)(struct ev_session*,void *userdata);
 
@@ -29,16 +45,31 @@ int ev_listener_addr(struct ev_listener* listener,char* addr,size_t length,int*
 void ev_listener_free(struct ev_listener* listener);
 
 struct ev_session* ev_session_bind(struct ev_loop_ctx* loop_ctx,int fd);
+size_t ev_session_size();
+struct ev_session* ev_session_init(void* mem,struct ev_loop_ctx* loop_ctx,int fd);
+void ev_session_fini(struct ev_session* ev_session);
 struct ev_session* ev_session_connect(struct ev_loop_ctx* loop_ctx,struct sockaddr* addr, int addrlen, int block, int* connected);
 void ev_session_free(struct ev_session* ev_session);
+int ev_session_detach(struct ev_session* ev_session,struct ev_detach* detach);
+void ev_session_attach(struct ev_session* ev_session,struct ev_detach* detach);
+void ev_detach_release(struct ev_detach* detach);
 void ev_session_setcb(struct ev_session* ev_session,ev_session_callback read_cb,ev_session_callback write_cb,ev_session_callback event_cb,void* userdata);
 void ev_session_enable(struct ev_session* ev_session,int ev);
 void ev_session_disable(struct ev_session* ev_session,int ev);
+void ev_session_set_budget(struct ev_session* ev_session,int budget);
+void ev_session_set_lowwater(struct ev_session* ev_session,int lowwater);
+void ev_session_set_cork(struct ev_session* ev_session,int cork);
 int ev_session_fd(struct ev_session* ev_session);
 size_t ev_session_input_size(struct ev_session* ev_session);
 size_t ev_session_output_size(struct ev_session* ev_session);
 size_t ev_session_read(struct ev_session* ev_session,char* data,size_t size);
+char* ev_session_peek(struct ev_session* ev_session,size_t size);
+size_t ev_session_drain(struct ev_session* ev_session,size_t size);
 char* ev_session_read_util(struct ev_session* ev_session,const char* sep,size_t size,char* out,size_t out_size,size_t* length);
 int ev_session_write(struct ev_session* ev_session,char* data,size_t size);
+int ev_session_write_shared(struct ev_session* ev_session,struct ev_shared* shared);
+
+struct ev_shared* ev_shared_create(size_t size);
+void ev_shared_release(struct ev_shared* shared);
 
 #endif
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "socket_util.h"
 
 int socket_nonblock(int fd) {
@@ -216,6 +219,28 @@ socket_write(int fd,char* data,size_t size) {
     return total;
 }
 
+int
+socket_writev(int fd,struct iovec* iov,int iovcnt) {
+    for (;;) {
+        int sz = (int)writev(fd, iov, iovcnt);
+        if (sz < 0) {
+            switch(errno)
+            {
+            case EINTR:
+                continue;
+            case EAGAIN:
+                return 0;
+            default:
+                fprintf(stderr,"writev fd :%d error:%s\n",fd,strerror(errno));
+                return -1;
+            }
+        } else if (sz == 0) {
+            return -1;
+        }
+        return sz;
+    }
+}
+
 int
 socket_udp_write(int fd,char* data,size_t size,struct sockaddr* addr,size_t addrlen) {
     int total = 0;
@@ -249,14 +274,20 @@ int
 socket_accept(int listen_fd,char* info,size_t length) {
     union sockaddr_all u;
     socklen_t len = sizeof(u);
-    int client_fd = accept(listen_fd, &u.s, &len);
+    //非阻塞和close-on-exec由accept4直接带上,其他选项只在这里设置
+    int client_fd = accept4(listen_fd, &u.s, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (client_fd < 0) {
-        snprintf(info, length, "%s", strerror(errno));
+        int error = errno;
+        snprintf(info, length, "%s", strerror(error));
+        errno = error;
         return -1;
     }
 
     socket_keep_alive(client_fd);
-    socket_nonblock(client_fd);
+
+    if (u.s.sa_family == AF_INET || u.s.sa_family == AF_INET6) {
+        socket_no_delay(client_fd);
+    }
 
     if (u.s.sa_family == AF_INET) {
         void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
@@ -18,8 +18,16 @@
 #include <string.h>
 #include <sys/prctl.h> 
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 #define HOST_SIZE 128
+//内核按min(backlog,somaxconn)截断,太小的话登录高峰时SYN会被丢掉,客户端要等重传
+#define LISTEN_BACKLOG 1024
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 
 union sockaddr_all {
@@ -49,6 +57,7 @@ int socket_bind(struct sockaddr *addr, int addrlen, int flag,int protocol);
 int socket_accept(int fd,char* info,size_t length);
 int socket_read(int fd,char* data,size_t size);
 int socket_write(int fd,char* data,size_t size);
+int socket_writev(int fd,struct iovec* iov,int iovcnt);
 int socket_udp_write(int fd,char* data,size_t size,struct sockaddr* addr,size_t addrlen);
 int socket_pipe_write(int fd, void* data, size_t size);
 int get_peername(int fd,char* out,size_t out_len,int* port);
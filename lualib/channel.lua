@@ -13,6 +13,7 @@ local tencode = table.encode
 local tdecode = table.decode
 local setmetatable = setmetatable
 local pairs = pairs
+local ipairs = ipairs
 local gen_session = event.gen_session
 local event_fork = event.fork
 local event_wait = event.wait
@@ -56,6 +57,7 @@ function channel:disconnect()
 		event_wakeup(session,false,"channel closed")
 	end
 	self.session_ctx = {}
+	self.drain_waiting = nil
 end
 
 function channel:read(num)
@@ -66,6 +68,50 @@ function channel:read_util(sep)
 	return self.channel_buff:read_util(sep)
 end
 
+function channel:read_budget(size)
+	self.channel_buff:read_budget(size)
+end
+
+--输出缓冲超过high时回调full,降到low以下回调drain,pause为true时full期间暂停读
+function channel:watermark(high,low,pause)
+	self.channel_buff:watermark(high,low,pause)
+end
+
+--cork模式下同一轮循环里的写合并成一次writev,在本轮循环结束时发出
+function channel:cork(on)
+	self.channel_buff:cork(on)
+end
+
+function channel:full()
+	self.blocked = true
+end
+
+function channel:drain()
+	self.blocked = nil
+	local waiting = self.drain_waiting
+	if waiting then
+		self.drain_waiting = nil
+		for _,session in ipairs(waiting) do
+			self.session_ctx[session] = nil
+			event_wakeup(session,true)
+		end
+	end
+end
+
+--生产者在输出缓冲满的时候等待,直到drain或者断开
+function channel:wait_drain()
+	if not self.blocked then
+		return true
+	end
+	local session = gen_session()
+	self.session_ctx[session] = {}
+	if not self.drain_waiting then
+		self.drain_waiting = {}
+	end
+	tinsert(self.drain_waiting,session)
+	return event_wait(session)
+end
+
 local function call_method(channel,session,file,method,args)
 	local ok,result = xpcall(import.dispatch,debug.traceback,file,method,channel,args)
 	if not ok then
@@ -103,6 +149,22 @@ function channel:data(data,size)
 	self:dispatch(message,size)
 end
 
+--批量模式下一次读到的所有包,包内存只在本次回调内有效
+--默认实现仍然每个包调一次self.data,要真正按批处理需要重写这个方法
+--连接被关掉或者转交之后剩下的包不再处理,转交时由新的reactor接着处理
+function channel:data_batch(count)
+	local channel_buff = self.channel_buff
+	for i = 1,count do
+		local ok,err = xpcall(self.data,debug.traceback,self,channel_buff:packet(i))
+		if not ok then
+			event_error(err)
+		end
+		if self.handing_off or not channel_buff:alive() then
+			break
+		end
+	end
+end
+
 function channel:send(file,method,args,callback)
 	local session = 0
 	if callback then
@@ -141,6 +203,15 @@ function channel:close()
 	self.channel_buff:close(false)
 end
 
+--把连接转交给另一个reactor,转交后本对象不再可用,还没处理的包由新的reactor接着处理
+function channel:handoff(reactor_id)
+	local ok,err = self.channel_buff:handoff(reactor_id)
+	if ok then
+		self.handing_off = true
+	end
+	return ok,err
+end
+
 function channel:close_immediately()
 	self.channel_buff:close(true)
 	self:disconnect()
@@ -14,6 +14,10 @@ local EV_TIMEOUT = 1
 local EV_ACCEPT = 2
 local EV_CONNECT = 3
 local EV_DATA = 4
+local EV_BATCH = 5
+local EV_DRAIN = 6
+local EV_FULL = 7
+local EV_CALLOUT = 8
 
 local _listener_ctx = setmetatable({},{__mode = "k"})
 local _channel_ctx = setmetatable({},{__mode = "k"})
@@ -109,7 +113,7 @@ local function resolve_addr(addr)
 	return result
 end
 
-function _M.listen(addr,header,callback,channel_class,multi)
+function _M.listen(addr,header,callback,channel_class,multi,batch)
 	local listener
 	local addr_form = resolve_addr(addr)
 	if not addr_form then
@@ -120,11 +124,24 @@ function _M.listen(addr,header,callback,channel_class,multi)
 	if not listener then
 		return false,reason
 	end
+	if batch then
+		listener:batch(true)
+	end
 	_listener_ctx[listener] = {callback = callback,channel_class = channel_class}
 	return listener
 end
 
-function _M.connect(addr,header,sync,channel_class)
+--同一进程里每个线程创建一个reactor加入group,listener:shard(group)之后accept到的连接分给这些reactor
+function _M.reactor(group,header,callback,channel_class,batch)
+	local reactor = _event:reactor(group,header)
+	if batch then
+		reactor:batch(true)
+	end
+	_listener_ctx[reactor] = {callback = callback,channel_class = channel_class}
+	return reactor
+end
+
+function _M.connect(addr,header,sync,channel_class,batch)
 	local addr_form = resolve_addr(addr)
 	if not addr_form then
 		return false,string.format("error addr:%s",addr)
@@ -135,6 +152,9 @@ function _M.connect(addr,header,sync,channel_class)
 		if not channel_buff then
 			return false,reason
 		end
+		if batch then
+			channel_buff:batch(true)
+		end
 		return create_channel(channel_class,channel_buff,addr)
 	end
 
@@ -152,6 +172,9 @@ function _M.connect(addr,header,sync,channel_class)
 	if not ok then
 		return ok,channel_buff
 	end
+	if batch then
+		channel_buff:batch(true)
+	end
 
 	return create_channel(channel_class,channel_buff,addr)
 end
@@ -174,6 +197,13 @@ function _M.timer(ti,callback)
 	return timer
 end
 
+--时间轮定时器,精度10ms,同一tick到期的定时器一次回调到lua,适合大量对象挂的定时器
+function _M.callout(ti,callback,once)
+	local timer = _event:callout(ti,not once and ti or nil)
+	_timer_ctx[timer] = callback
+	return timer
+end
+
 function _M.udp(size,callback,ip,port)
 	local udp_session,err = _event:udp(size,callback,ip,port)
 	if udp_session then
@@ -183,19 +213,19 @@ function _M.udp(size,callback,ip,port)
 end
 
 function _M.pipe(func)
-	local pipe,fd = _event:pipe(func)
+	local pipe,channel = _event:pipe(func)
 	if pipe then
-		_pipe_ctx[pipe] = fd
+		_pipe_ctx[pipe] = channel
 	end
-	return pipe,fd
+	return pipe,channel
 end
 
-function _M.gate(max)
-	local gate = _event:gate(max)
+function _M.gate(max,freq,timeout,threads,compress)
+	local gate,err = _event:gate(max,freq,timeout,threads,compress)
 	if gate then
 		_gate_ctx[gate] = true
 	end
-	return gate
+	return gate,err
 end
 
 function _M.dns(host,func)
@@ -363,6 +393,18 @@ EV[EV_TIMEOUT] = function (timer)
 	end
 end
 
+EV[EV_CALLOUT] = function (list,count)
+	for i = 1,count do
+		local timer = list[i]
+		if timer:alive() then
+			local ok,err = xpcall(_timer_ctx[timer],traceback,timer)
+			if not ok then
+				_M.error(err)
+			end
+		end
+	end
+end
+
 EV[EV_ACCEPT] = function (listener,channel_buff,addr)
 	local info = _listener_ctx[listener]
 	local channel_obj = create_channel(info.channel_class,channel_buff,addr)
@@ -378,6 +420,21 @@ EV[EV_DATA] = function (channel_buff,data,size)
 	channel:data(data,size)
 end
 
+EV[EV_BATCH] = function (channel_buff,count)
+	local channel = _channel_ctx[channel_buff]
+	channel:data_batch(count)
+end
+
+EV[EV_FULL] = function (channel_buff)
+	local channel = _channel_ctx[channel_buff]
+	channel:full()
+end
+
+EV[EV_DRAIN] = function (channel_buff)
+	local channel = _channel_ctx[channel_buff]
+	channel:drain()
+end
+
 EV[EV_ERROR] = function (channel_buff)
 	local channel = _channel_ctx[channel_buff]
 	channel:disconnect()
@@ -13,6 +13,7 @@ end
 
 function mongo_channel:init()
 	self.session_ctx = {}
+	self:read_budget(4 * 1024 * 1024)
 end
 
 function mongo_channel:data(data,size)
@@ -0,0 +1,64 @@
+local event = require "event"
+local name_core = require "name.core"
+
+--worker和tp共用的消息头:按位置打包,类型,文件id,方法id,参数;返回消息只有类型和结果
+local _M = {}
+
+local MESSAGE_CALL = 0
+local MESSAGE_RET = 1
+local MESSAGE_ERR = 2
+
+_M.MESSAGE_CALL = MESSAGE_CALL
+_M.MESSAGE_RET = MESSAGE_RET
+_M.MESSAGE_ERR = MESSAGE_ERR
+
+--文件名和方法名在进程内换成id,本地缓存两个方向的映射
+local _name_id = {}
+local _id_name = {}
+
+local function name_id(name)
+	local id = _name_id[name]
+	if not id then
+		id = name_core.id(name)
+		_name_id[name] = id
+		_id_name[id] = name
+	end
+	return id
+end
+
+local function id_name(id)
+	local name = _id_name[id]
+	if not name then
+		name = name_core.str(id)
+		_id_name[id] = name
+		_name_id[name] = id
+	end
+	return name
+end
+
+_M.name_id = name_id
+_M.id_name = id_name
+
+--返回serialize.pack的lightuserdata和长度,所有权交给调用者
+function _M.pack_call(file,method,args)
+	return table.encode(MESSAGE_CALL,name_id(file),name_id(method),args)
+end
+
+function _M.pack_ret(ok,result)
+	return table.encode(ok and MESSAGE_RET or MESSAGE_ERR,result)
+end
+
+--callback里有的是一次性回调,没有的唤醒等待中的协程
+function _M.dispatch_ret(callback,session,kind,result)
+	local func = callback[session]
+	if func then
+		callback[session] = nil
+		if kind == MESSAGE_RET then
+			func(result)
+		end
+	else
+		event.wakeup(session,kind == MESSAGE_RET,result)
+	end
+end
+
+return _M
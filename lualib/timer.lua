@@ -12,13 +12,13 @@ local function createTimer(interval,freq,inst,method,...)
 		rawset(inst,"__timer",__timer)
 	end
 
-	local timer = event.timer(interval,function ()
+	local timer = event.callout(interval,function (timer)
 		if not freq then
 			timer:cancel()
 			__timer[timer] = nil
 		end
 		event.fork(inst[method],inst,table.unpack(args))
-	end)
+	end,not freq)
 	__timer[timer] = true 
 	return timer
 end
@@ -1,24 +1,39 @@
 local event = require "event"
 local import = require "import"
 local tp_core = require "tp.core"
+local thread_message = require "thread_message"
 
 local _M = {}
 
 local _session_callback = {}
 
 local _pipe
-local _pipe_fd
+local _pipe_channel
 
 local _tp_main
 local _tp_child
 
+local MESSAGE_CALL = thread_message.MESSAGE_CALL
+local id_name = thread_message.id_name
+
+--和worker一样按位置打包消息头,返回lightuserdata和长度,所有权交给c层
+local pack_call = thread_message.pack_call
+local pack_ret = thread_message.pack_ret
+
+local function dispatch_ret(session,kind,result)
+	thread_message.dispatch_ret(_session_callback,session,kind,result)
+end
+
 function _M.send(file,method,args)
-	_tp_main:push(0,table.tostring({file = file,method = method,args = args}))
+	_tp_main:push(0,pack_call(file,method,args))
 end
 
-function _M.call(file,method,args,func)
-	local session = event.gen_session()
-	_tp_main:push(session,table.tostring({file = file,method = method,args = args}))
+--同一个key的消息固定在同一个线程上按顺序执行
+function _M.send_affinity(key,file,method,args)
+	_tp_main:push_affinity(key,0,pack_call(file,method,args))
+end
+
+local function wait_result(session,func)
 	if func then
 		_session_callback[session] = func
 		return
@@ -30,48 +45,42 @@ function _M.call(file,method,args,func)
 	return result
 end
 
+function _M.call(file,method,args,func)
+	local session = event.gen_session()
+	_tp_main:push(session,pack_call(file,method,args))
+	return wait_result(session,func)
+end
+
+function _M.call_affinity(key,file,method,args,func)
+	local session = event.gen_session()
+	_tp_main:push_affinity(key,session,pack_call(file,method,args))
+	return wait_result(session,func)
+end
+
 function _M.create(count,boot_param)
 	if not _pipe then
-		_pipe,_pipe_fd = event.pipe(function (pipe,source,session,data,size)
-			local message = table.decode(data,size)
-			assert(message.ret == true)
-
-			if _session_callback[session] then
-				if message.args then
-					_session_callback[session](message.args)
-				end
-			else
-				if message.args then
-					event.wakeup(session,true,message.args)
-				else
-					event.wakeup(session,false,message.err)
-				end
-			end
+		_pipe,_pipe_channel = event.pipe(function (pipe,source,session,data,size)
+			local kind,result = table.decode(data,size)
+			assert(kind ~= MESSAGE_CALL)
+			dispatch_ret(session,kind,result)
 		end)
 	end
-	_tp_main = tp_core.create(_pipe_fd,count,boot_param)
+	_tp_main = tp_core.create(_pipe_channel,count,boot_param)
 	return _tp_main
 end
 
 function _M.dispatch(tp_ud)
 	_tp_child = tp_ud
 	_tp_child:dispatch(function (session,data,size)
-		local message = table.decode(data,size)
-		if message.ret then
-			if _session_callback[session] then
-				if message.args then
-					_session_callback[session](message.args)
-				end
-			else
-				if message.args then
-					event.wakeup(session,true,message.args)
-				else
-					event.wakeup(session,false,message.err)
-				end
-			end
+		local kind,file,method,args = table.decode(data,size)
+		if kind ~= MESSAGE_CALL then
+			--返回消息的第二个值就是结果
+			dispatch_ret(session,kind,file)
 		else
+			file = id_name(file)
+			method = id_name(method)
 			event.fork(function ()
-				local ok,result = xpcall(import.dispatch,debug.traceback,message.file,message.method,message.args)
+				local ok,result = xpcall(import.dispatch,debug.traceback,file,method,args)
 				if session == 0 then
 					if not ok then
 						event.error(result)
@@ -79,11 +88,7 @@ function _M.dispatch(tp_ud)
 					return
 				end
 
-				if not ok then
-					_tp_child:send(session,table.tostring({ret = true,err = result}))
-				else
-					_tp_child:send(session,table.tostring({ret = true,args = result}))
-				end
+				_tp_child:send(session,pack_ret(ok,result))
 			end)
 		end
 	end)
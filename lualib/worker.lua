@@ -1,6 +1,7 @@
 local event = require "event"
 local import = require "import"
 local worker = require "worker.core"
+local thread_message = require "thread_message"
 
 local _M = {}
 
@@ -8,19 +9,35 @@ local _session_callback = {}
 
 --for creator
 local _pipe
-local _pipe_fd
+local _pipe_channel
 local _worker_group = {}
 
 --for worker
 local _worker_userdata
 
+local MESSAGE_CALL = thread_message.MESSAGE_CALL
+local id_name = thread_message.id_name
+
+--序列化结果直接包成buffer,push时只转移指针,不再经过lua字符串拷贝
+local function pack_call(file,method,args)
+	return worker.buffer(thread_message.pack_call(file,method,args))
+end
+
+local function pack_ret(ok,result)
+	return worker.buffer(thread_message.pack_ret(ok,result))
+end
+
+local function dispatch_ret(session,kind,result)
+	thread_message.dispatch_ret(_session_callback,session,kind,result)
+end
+
 function _M.master_send(target,file,method,args)
-	worker.push(target,0,table.tostring({file = file,method = method,args = args}))
+	worker.push(target,0,pack_call(file,method,args))
 end
 
 function _M.master_call(target,file,method,args,func)
 	local session = event.gen_session()
-	worker.push(target,session,table.tostring({file = file,method = method,args = args}))
+	worker.push(target,session,pack_call(file,method,args))
 	if func then
 		_session_callback[session] = func
 		return
@@ -34,34 +51,20 @@ end
 
 function _M.create(args)
 	if not _pipe then
-		_pipe,_pipe_fd = event.pipe(function (pipe,source,session,data,size)
-			local message = table.decode(data,size)
-			if message.ret then
-				if _session_callback[session] then
-					if message.args then
-						_session_callback[session](message.args)
-					end
-				else
-					if message.args then
-						event.wakeup(session,true,message.args)
-					else
-						event.wakeup(session,false,message.err)
-					end
-				end
+		_pipe,_pipe_channel = event.pipe(function (pipe,source,session,data,size)
+			local kind,file,method,args = table.decode(data,size)
+			if kind ~= MESSAGE_CALL then
+				--返回消息的第二个值就是结果
+				dispatch_ret(session,kind,file)
 			else
-
-				local ok,result = xpcall(import.dispatch,debug.traceback,message.file,message.method,message.args)
+				local ok,result = xpcall(import.dispatch,debug.traceback,id_name(file),id_name(method),args)
 				if session ~= 0 then
-					if not ok then
-						worker:push(source,session,table.tostring({ret = true,err = result}))
-					else
-						worker:push(source,session,table.tostring({ret = true,args = result}))
-					end
+					worker.push(source,session,pack_ret(ok,result))
 				end
 			end
 		end)
 	end
-	local pid = worker.create(_pipe_fd,args)
+	local pid = worker.create(_pipe_channel,args)
 	table.insert(_worker_group,pid)
 	return pid
 end
@@ -75,22 +78,15 @@ end
 function _M.dispatch(worker_ud)
 	_worker_userdata = worker_ud
 	_worker_userdata:dispatch(function (source,session,data,size)
-		local message = table.decode(data,size)
-		if message.ret then
-			if _session_callback[session] then
-				if message.args then
-					_session_callback[session](message.args)
-				end
-			else
-				if message.args then
-					event.wakeup(session,true,message.args)
-				else
-					event.wakeup(session,false,message.err)
-				end
-			end
+		local kind,file,method,args = table.decode(data,size)
+		if kind ~= MESSAGE_CALL then
+			--返回消息的第二个值就是结果
+			dispatch_ret(session,kind,file)
 		else
+			file = id_name(file)
+			method = id_name(method)
 			event.fork(function ()
-				local ok,result = xpcall(import.dispatch,debug.traceback,message.file,message.method,message.args)
+				local ok,result = xpcall(import.dispatch,debug.traceback,file,method,args)
 				if session == 0 then
 					if not ok then
 						event.error(result)
@@ -99,17 +95,9 @@ function _M.dispatch(worker_ud)
 				end
 
 				if source < 0 then
-					if not ok then
-						_worker_userdata:send_pipe(session,table.tostring({ret = true,err = result}))
-					else
-						_worker_userdata:send_pipe(session,table.tostring({ret = true,args = result}))
-					end
+					_worker_userdata:send_pipe(session,pack_ret(ok,result))
 				else
-					if not ok then
-						_worker_userdata:push(source,session,table.tostring({ret = true,err = result}))
-					else
-						_worker_userdata:push(source,session,table.tostring({ret = true,args = result}))
-					end
+					_worker_userdata:push(source,session,pack_ret(ok,result))
 				end
 			end)
 		end
@@ -121,12 +109,12 @@ function _M.quit()
 end
 
 function _M.send_worker(target,file,method,args)
-	_worker_userdata:push(target,0,table.tostring({file = file,method = method,args = args}))
+	_worker_userdata:push(target,0,pack_call(file,method,args))
 end
 
 function _M.call_worker(target,file,method,args,func)
 	local session = event.gen_session()
-	_worker_userdata:push(target,session,table.tostring({file = file,method = method,args = args}))
+	_worker_userdata:push(target,session,pack_call(file,method,args))
 	if func then
 		_session_callback[session] = func
 		return
@@ -139,12 +127,12 @@ function _M.call_worker(target,file,method,args,func)
 end
 
 function _M.send_pipe(file,method,args)
-	_worker_userdata:send_pipe(0,table.tostring({file = file,method = method,args = args}))
+	_worker_userdata:send_pipe(0,pack_call(file,method,args))
 end
 
 function _M.call_pipe(file,method,args,func)
 	local session = event.gen_session()
-	_worker_userdata:send_pipe(session,table.tostring({file = file,method = method,args = args}))
+	_worker_userdata:send_pipe(session,pack_call(file,method,args))
 	if func then
 		_session_callback[session] = func
 		return
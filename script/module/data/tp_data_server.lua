@@ -137,7 +137,7 @@ function doSaveUser(self,userUid,dirtyData)
 				end
 
 				sql = string.format(sql,table.concat(subSql,","))
-				tp.send("handler.data_mysql","executeSql",sql)
+				tp.send_affinity(userUid,"handler.data_mysql","executeSql",sql)
 			end
 			
 		else
@@ -147,7 +147,7 @@ function doSaveUser(self,userUid,dirtyData)
 				table.insert(fieldSql,string.format("%s='%s'",field,tostring(dbUserTb[field])))
 			end
 			sql = string.format(sql,table.concat(fieldSql,","))
-			tp.send("handler.data_mysql","executeSql",sql)
+			tp.send_affinity(userUid,"handler.data_mysql","executeSql",sql)
 		end
 	end
 end
@@ -175,7 +175,7 @@ function loadUser(_,args)
 		return user
 	end
 
-	local dbUserInfo = tp.call("handler.data_mysql","loadUser",args.userUid)
+	local dbUserInfo = tp.call_affinity(args.userUid,"handler.data_mysql","loadUser",args.userUid)
 
 	model.bind_dbUser_with_uid(args.userUid,dbUserInfo)
 
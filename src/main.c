@@ -73,6 +73,22 @@ thread_main(void* args) {
 	return NULL;
 }
 
+static int
+boot_count(const char* boot,const char** entry) {
+	char* end = NULL;
+	long count = strtol(boot, &end, 10);
+	if (end != boot && *end == '*' && count > 0) {
+		if (entry) {
+			*entry = end + 1;
+		}
+		return count;
+	}
+	if (entry) {
+		*entry = boot;
+	}
+	return 1;
+}
+
 /*
 TCMALLOC_DEBUG=<level>      调试级别，取值为1-2
 MALLOCSTATS=<level>         设置显示内存使用状态级别，取值为1-2
@@ -103,21 +119,36 @@ int main(int argc,const char* argv[]) {
 	// ignore_signal(SIGPROF);
 	register_signal(SIGUSR1,signal_deadloop);
 
-	if (argc > 2) {
-		pthread_t* pids = malloc(sizeof(pthread_t) * (argc - 1));
-		int i;
+	//"N*entry@args"表示用同一个入口起N个线程,每个线程一个lua state和事件循环,
+	//配合event.reactor和listener:shard做多reactor
+	int total = 0;
+	int i;
+	for(i = 1;i < argc;i++) {
+		total += boot_count(argv[i], NULL);
+	}
+
+	if (total > 1) {
+		pthread_t* pids = malloc(sizeof(pthread_t) * total);
+		int index = 0;
 		for(i = 1;i < argc;i++) {
-			if (pthread_create(&pids[i-1], NULL, thread_main, (void*)argv[i])) {
-				fprintf(stderr, "create thread mail failed");
-				exit(1);
+			const char* entry = NULL;
+			int count = boot_count(argv[i], &entry);
+			int j;
+			for(j = 0;j < count;j++) {
+				if (pthread_create(&pids[index++], NULL, thread_main, (void*)entry)) {
+					fprintf(stderr, "create thread mail failed");
+					exit(1);
+				}
 			}
 		}
-		for(i = 0;i < argc - 1;i++) {
+		for(i = 0;i < total;i++) {
 			pthread_join(pids[i], NULL);
 		}
-
+		free(pids);
 	} else {
-		thread_main((void*)argv[1]);
+		const char* entry = NULL;
+		boot_count(argv[1], &entry);
+		thread_main((void*)entry);
 	}
 
 	return 0;
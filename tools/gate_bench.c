@@ -0,0 +1,483 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "socket/gate.h"
+#include "common/encrypt.h"
+#include "lz4.h"
+
+//gate压测:默认fork一个本地echo gate,再开一批加密机器人按消息id比例发包,统计往返延迟、吞吐和服务端cpu
+
+#define MAX_MIX 		32
+#define TICK 			0.01
+#define READ_SIZE 		64 * 1024
+#define COMPRESS_FLAG 	0x8000
+
+typedef struct message_mix {
+	uint16_t id;
+	uint32_t weight;
+} message_mix_t;
+
+typedef struct bench_option {
+	const char* ip;
+	int port;
+	int clients;
+	int duration;
+	int rate;
+	int size;
+	int threads;
+	int aggregate;
+	int compress;
+	message_mix_t mix[MAX_MIX];
+	int mix_count;
+	uint32_t mix_total;
+} bench_option_t;
+
+typedef struct bot {
+	int fd;
+	uint16_t seed;
+	double credit;
+	struct ev_io rio;
+	uint8_t* buffer;
+	size_t length;
+} bot_t;
+
+typedef struct bench {
+	bench_option_t* option;
+	struct ev_loop_ctx* loop_ctx;
+	bot_t* bots;
+	int alive;
+	double start;
+	double stop;
+	uint64_t sent;
+	uint64_t received;
+	uint64_t blocked;
+	uint32_t* latency;
+	size_t latency_count;
+	size_t latency_size;
+	uint32_t cursor;
+} bench_t;
+
+static inline uint64_t
+now_usec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//-------------------------echo server---------------------------
+static gate_t* ECHO_GATE = NULL;
+
+static void
+echo_accept(void* ud,uint32_t client_id,const char* addr) {
+}
+
+static void
+echo_close(void* ud,uint32_t client_id,const char* reason) {
+}
+
+static void
+echo_data(void* ud,uint32_t client_id,int message_id,void* data,size_t size) {
+	gate_send(ECHO_GATE, client_id, message_id, data, size);
+}
+
+static pid_t
+echo_server(bench_option_t* option) {
+	int fd[2];
+	if (pipe(fd) < 0) {
+		fprintf(stderr, "echo server pipe error:%s\n", strerror(errno));
+		exit(1);
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "echo server fork error:%s\n", strerror(errno));
+		exit(1);
+	}
+	if (pid > 0) {
+		close(fd[1]);
+		if (read(fd[0], &option->port, sizeof(option->port)) != sizeof(option->port) || option->port <= 0) {
+			fprintf(stderr, "echo server start failed\n");
+			exit(1);
+		}
+		close(fd[0]);
+		return pid;
+	}
+
+	close(fd[0]);
+	struct ev_loop_ctx* loop_ctx = loop_ctx_create();
+	uint32_t max_client = option->clients + 16;
+	uint32_t max_freq = option->rate * 10 + 100;
+	if (option->threads > 0) {
+		ECHO_GATE = gate_create_threaded(loop_ctx, max_client, max_freq, 60, option->compress, option->threads, NULL);
+	} else {
+		ECHO_GATE = gate_create(loop_ctx, max_client, max_freq, 60, option->compress, NULL);
+	}
+	gate_callback(ECHO_GATE, echo_accept, echo_close, echo_data);
+	if (option->aggregate) {
+		gate_aggregate(ECHO_GATE, 1);
+	}
+	int port = gate_start(ECHO_GATE, option->ip, 0);
+	if (write(fd[1], &port, sizeof(port)) != sizeof(port)) {
+		exit(1);
+	}
+	close(fd[1]);
+	loop_ctx_dispatch(loop_ctx);
+	exit(0);
+}
+
+static double
+process_cpu(pid_t pid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		return -1;
+	}
+	unsigned long utime = 0, stime = 0;
+	int ret = fscanf(file, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+	fclose(file);
+	if (ret != 2) {
+		return -1;
+	}
+	return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+//-------------------------bots---------------------------
+static inline uint16_t
+mix_next(bench_t* bench) {
+	bench_option_t* option = bench->option;
+	uint32_t value = (bench->cursor++ * 2654435761u) % option->mix_total;
+	int i;
+	for(i = 0;i < option->mix_count;i++) {
+		if (value < option->mix[i].weight) {
+			return option->mix[i].id;
+		}
+		value -= option->mix[i].weight;
+	}
+	return option->mix[0].id;
+}
+
+static inline void
+latency_push(bench_t* bench,uint32_t usec) {
+	if (bench->latency_count == bench->latency_size) {
+		bench->latency_size *= 2;
+		bench->latency = realloc(bench->latency, sizeof(uint32_t) * bench->latency_size);
+	}
+	bench->latency[bench->latency_count++] = usec;
+}
+
+static void
+bot_close(bench_t* bench,bot_t* bot) {
+	if (bot->fd < 0) {
+		return;
+	}
+	ev_io_stop(loop_ctx_get(bench->loop_ctx), &bot->rio);
+	close(bot->fd);
+	bot->fd = -1;
+	bench->alive--;
+}
+
+static void
+bot_send(bench_t* bench,bot_t* bot) {
+	int size = bench->option->size;
+	uint8_t payload[size];
+	memset(payload, 'x', size);
+	uint64_t now = now_usec();
+	memcpy(payload, &now, sizeof(now));
+
+	uint8_t* data = message_encrypt(&bot->seed, mix_next(bench), payload, size);
+	size_t total = size + sizeof(uint16_t) * 3;
+	ssize_t n = write(bot->fd, data, total);
+	free(data);
+	if (n == total) {
+		bench->sent++;
+		return;
+	}
+	if (n >= 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+		//半包会破坏后续帧,压测里直接算失败断开
+		if (n > 0) {
+			fprintf(stderr, "bot partial write,close\n");
+			bot_close(bench, bot);
+		}
+		bench->blocked++;
+		return;
+	}
+	bot_close(bench, bot);
+}
+
+//返回-1表示帧格式不对,调用者断开
+static int
+bot_frame(bench_t* bench,uint16_t id,uint8_t* data,size_t size) {
+	uint64_t stamp;
+	if (id & COMPRESS_FLAG) {
+		uint16_t raw;
+		if (size < sizeof(raw)) {
+			return -1;
+		}
+		memcpy(&raw, data, sizeof(raw));
+		if (raw == 0) {
+			return -1;
+		}
+		char out[raw];
+		if (LZ4_decompress_safe((char*)data + sizeof(raw), out, size - sizeof(raw), raw) < (int)sizeof(stamp)) {
+			return 0;
+		}
+		memcpy(&stamp, out, sizeof(stamp));
+	} else {
+		if (size < sizeof(stamp)) {
+			return 0;
+		}
+		memcpy(&stamp, data, sizeof(stamp));
+	}
+	bench->received++;
+	latency_push(bench, now_usec() - stamp);
+	return 0;
+}
+
+static void
+bot_read(struct ev_loop* loop,struct ev_io* io,int revents) {
+	bench_t* bench = io->data;
+	bot_t* bot = (bot_t*)((char*)io - offsetof(bot_t, rio));
+
+	ssize_t n = read(bot->fd, bot->buffer + bot->length, READ_SIZE - bot->length);
+	if (n <= 0) {
+		if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+			return;
+		}
+		bot_close(bench, bot);
+		return;
+	}
+	bot->length += n;
+
+	size_t offset = 0;
+	while(bot->length - offset >= sizeof(uint16_t) * 2) {
+		uint16_t total;
+		uint16_t id;
+		memcpy(&total, bot->buffer + offset, sizeof(total));
+		memcpy(&id, bot->buffer + offset + sizeof(uint16_t), sizeof(id));
+		//长度连包头都不够,后面的流已经没法对齐
+		if (total < sizeof(uint16_t) * 2) {
+			fprintf(stderr, "bot bad frame size:%d,close\n", total);
+			bot_close(bench, bot);
+			return;
+		}
+		if (bot->length - offset < total) {
+			break;
+		}
+		if (bot_frame(bench, id, bot->buffer + offset + sizeof(uint16_t) * 2, total - sizeof(uint16_t) * 2) < 0) {
+			fprintf(stderr, "bot bad compress frame,close\n");
+			bot_close(bench, bot);
+			return;
+		}
+		offset += total;
+	}
+	memmove(bot->buffer, bot->buffer + offset, bot->length - offset);
+	bot->length -= offset;
+}
+
+static void
+bench_tick(struct ev_loop* loop,struct ev_timer* io,int revents) {
+	bench_t* bench = io->data;
+	double now = loop_ctx_now(bench->loop_ctx);
+	if (now >= bench->stop || bench->alive == 0) {
+		ev_timer_stop(loop, io);
+		loop_ctx_break(bench->loop_ctx);
+		return;
+	}
+	double credit = bench->option->rate * TICK;
+	int i;
+	for(i = 0;i < bench->option->clients;i++) {
+		bot_t* bot = &bench->bots[i];
+		if (bot->fd < 0) {
+			continue;
+		}
+		bot->credit += credit;
+		while(bot->credit >= 1 && bot->fd >= 0) {
+			bot->credit -= 1;
+			bot_send(bench, bot);
+		}
+	}
+}
+
+static int
+latency_compare(const void* a,const void* b) {
+	uint32_t l = *(const uint32_t*)a;
+	uint32_t r = *(const uint32_t*)b;
+	return l < r ? -1 : (l > r ? 1 : 0);
+}
+
+static inline uint32_t
+latency_percent(bench_t* bench,double percent) {
+	if (bench->latency_count == 0) {
+		return 0;
+	}
+	size_t index = bench->latency_count * percent;
+	if (index >= bench->latency_count) {
+		index = bench->latency_count - 1;
+	}
+	return bench->latency[index];
+}
+
+//-------------------------main---------------------------
+static int
+parse_mix(bench_option_t* option,const char* str) {
+	option->mix_count = 0;
+	option->mix_total = 0;
+	while(*str && option->mix_count < MAX_MIX) {
+		unsigned int id, weight;
+		int n = 0;
+		if (sscanf(str, "%u:%u%n", &id, &weight, &n) != 2 || id >= COMPRESS_FLAG || weight == 0) {
+			return -1;
+		}
+		option->mix[option->mix_count].id = id;
+		option->mix[option->mix_count].weight = weight;
+		option->mix_count++;
+		option->mix_total += weight;
+		str += n;
+		if (*str == ',') {
+			str++;
+		}
+	}
+	return option->mix_count > 0 ? 0 : -1;
+}
+
+static void
+usage(const char* name) {
+	fprintf(stderr, "usage:%s [-h ip] [-p port] [-c clients] [-d seconds] [-r msg/s per client] [-s payload size] [-m id:weight,...] [-t io threads] [-a] [-z compress threshold]\n", name);
+	fprintf(stderr, "  without -p a local echo gate is forked with -t/-a/-z, with -p an external gate must echo every message back\n");
+}
+
+int
+main(int argc,char** argv) {
+	bench_option_t option;
+	memset(&option, 0, sizeof(option));
+	option.ip = "127.0.0.1";
+	option.clients = 1000;
+	option.duration = 10;
+	option.rate = 10;
+	option.size = 32;
+	parse_mix(&option, "1:1");
+
+	int opt;
+	while((opt = getopt(argc, argv, "h:p:c:d:r:s:m:t:az:")) != -1) {
+		switch(opt) {
+			case 'h': option.ip = optarg; break;
+			case 'p': option.port = atoi(optarg); break;
+			case 'c': option.clients = atoi(optarg); break;
+			case 'd': option.duration = atoi(optarg); break;
+			case 'r': option.rate = atoi(optarg); break;
+			case 's': option.size = atoi(optarg); break;
+			case 't': option.threads = atoi(optarg); break;
+			case 'a': option.aggregate = 1; break;
+			case 'z': option.compress = atoi(optarg); break;
+			case 'm': {
+				if (parse_mix(&option, optarg) < 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			}
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (option.clients <= 0 || option.duration <= 0 || option.rate <= 0 || option.size < (int)sizeof(uint64_t) || option.size > 4096) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	struct rlimit limit = { option.clients * 2 + 64, option.clients * 2 + 64 };
+	if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+		fprintf(stderr, "setrlimit nofile:%d error:%s\n", option.clients * 2 + 64, strerror(errno));
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	pid_t server = 0;
+	if (option.port == 0) {
+		server = echo_server(&option);
+	}
+
+	bench_t bench;
+	memset(&bench, 0, sizeof(bench));
+	bench.option = &option;
+	bench.loop_ctx = loop_ctx_create();
+	bench.bots = malloc(sizeof(bot_t) * option.clients);
+	bench.latency_size = 1024;
+	bench.latency = malloc(sizeof(uint32_t) * bench.latency_size);
+
+	struct sockaddr_in si;
+	memset(&si, 0, sizeof(si));
+	si.sin_family = AF_INET;
+	si.sin_addr.s_addr = inet_addr(option.ip);
+	si.sin_port = htons(option.port);
+
+	int i;
+	for(i = 0;i < option.clients;i++) {
+		bot_t* bot = &bench.bots[i];
+		memset(bot, 0, sizeof(*bot));
+		int status;
+		bot->fd = socket_connect((struct sockaddr*)&si, sizeof(si), 1, &status);
+		if (bot->fd < 0) {
+			fprintf(stderr, "bot:%d connect %s:%d error:%s\n", i, option.ip, option.port, strerror(errno));
+			continue;
+		}
+		socket_nonblock(bot->fd);
+		socket_no_delay(bot->fd);
+		bot->buffer = malloc(READ_SIZE);
+		bot->credit = (double)i / option.clients;
+		bot->rio.data = &bench;
+		ev_io_init(&bot->rio, bot_read, bot->fd, EV_READ);
+		ev_io_start(loop_ctx_get(bench.loop_ctx), &bot->rio);
+		bench.alive++;
+	}
+
+	double cpu = server ? process_cpu(server) : -1;
+
+	struct ev_timer ticker;
+	ticker.data = &bench;
+	ev_timer_init(&ticker, bench_tick, TICK, TICK);
+	ev_timer_start(loop_ctx_get(bench.loop_ctx), &ticker);
+
+	ev_now_update(loop_ctx_get(bench.loop_ctx));
+	bench.start = loop_ctx_now(bench.loop_ctx);
+	bench.stop = bench.start + option.duration;
+	uint64_t start = now_usec();
+	loop_ctx_dispatch(bench.loop_ctx);
+	double elapse = (now_usec() - start) / 1000000.0;
+
+	if (server) {
+		double used = process_cpu(server);
+		cpu = (cpu >= 0 && used >= 0) ? (used - cpu) / elapse * 100 : -1;
+	}
+
+	qsort(bench.latency, bench.latency_count, sizeof(uint32_t), latency_compare);
+
+	printf("clients:%d alive:%d duration:%.2fs rate:%d/s size:%d threads:%d aggregate:%d compress:%d\n", option.clients, bench.alive, elapse, option.rate, option.size, option.threads, option.aggregate, option.compress);
+	printf("sent:%lu received:%lu blocked:%lu\n", bench.sent, bench.received, bench.blocked);
+	printf("throughput:%.0f msg/s\n", bench.received / elapse);
+	printf("latency(us) p50:%u p99:%u max:%u\n", latency_percent(&bench, 0.5), latency_percent(&bench, 0.99), latency_percent(&bench, 1));
+	if (server) {
+		printf("server cpu:%.1f%%\n", cpu);
+	}
+
+	for(i = 0;i < option.clients;i++) {
+		bot_close(&bench, &bench.bots[i]);
+		free(bench.bots[i].buffer);
+	}
+	free(bench.bots);
+	free(bench.latency);
+	loop_ctx_release(bench.loop_ctx);
+
+	if (server) {
+		kill(server, SIGKILL);
+		waitpid(server, NULL, 0);
+	}
+	return 0;
+}